@@ -0,0 +1,10 @@
+-- Rendering microbenchmarks: times every drawing binding from C and from
+-- Lua and prints a JSON report. Run it with the host build
+-- (luamatrix_host -q bench.lua) or copy it over display.lua on a device.
+
+report = render_bench()
+print(report)
+
+if mqtt_connected() then
+    mqtt_publish("luamatrix/bench", report)
+end
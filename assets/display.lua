@@ -107,7 +107,6 @@ function update_balls(delta)
     for k,v in pairs(balls) do
         if v['dead'] == false then
             ball_count = ball_count + 1
-            draw_filled_circle(math.floor(v['x']), math.floor(v['y']), r, 0,0,0)
             v['x'] = v['x'] + v['dx'] * delta
             v['y'] = v['y'] + v['dy'] * delta
             
@@ -138,7 +137,6 @@ end
 function update_particles(delta)
     for k,v in pairs(particles) do
         if v['dead'] == false then
-            set_pixel(math.floor(v['x']), math.floor(v['y']), 0,0,0)
             v['x'] = v['x'] + v['dx'] * delta
             v['y'] = v['y'] + v['dy'] * delta
             
@@ -197,7 +195,6 @@ function ship()
             if math.sqrt(dx*dx+dy*dy) < 20 then
                 -- Ignore already dying balls
                 if v['dying'] == false then
-                    draw_filled_circle(math.floor(v['x']), math.floor(v['y']), r, 0,0,0)
                     v['dying']=true
                     v['death_time']=millis() + 500
                     v['arc_x'] = math.floor(v['x'])
@@ -210,9 +207,7 @@ function ship()
             
             -- Update Death animation
             if v['dying'] == true then
-                draw_line(x, y, v['arc_x'], v['arc_y'], 0,0,0)
                 if millis() > v['death_time'] then
-                    draw_filled_circle(math.floor(v['x']), math.floor(v['y']), r, 0,0,0)
                     v['dead'] = true
                     boom(math.floor(v['x']), math.floor(v['y']))
                 else
@@ -242,7 +237,10 @@ lastframetime=0
 
 timestamp=0
 while(1) do
-    
+    -- Each frame is drawn from scratch into the back buffer, so nothing
+    -- has to be erased before it moves
+    begin_frame()
+
     delta=millis()-timestamp
     update_balls(delta)
     update_particles(delta)
@@ -254,9 +252,9 @@ while(1) do
     update_frame_time()
     if millis() - tick > 1000 then
         tick = millis()
-        draw_string(tostring(lastframetime), 2, 2, 0, 0, 0, 5)
         lastframetime=frametime
-        draw_string(tostring(lastframetime), 2, 2, 0, 255, 0, 5)
-        
     end
+    draw_string(tostring(lastframetime), 2, 2, 0, 255, 0, 5)
+
+    present()
 end
\ No newline at end of file
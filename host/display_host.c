@@ -0,0 +1,206 @@
+// Software implementation of display.h for the host build. Draws into an
+// in-memory RGB888 framebuffer instead of the HUB75 driver.
+
+#include "display.h"
+#include "host_display.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* TAG = "display";
+
+static int s_width = 64 * 3;
+static int s_height = 64;
+static int s_brightness = 128;
+
+// s_fb is what the panel shows. In frame mode drawing goes to s_back and
+// display_present() swaps the two.
+static uint8_t *s_fb;
+static uint8_t *s_back;
+static uint8_t *s_draw;
+static bool s_frame_mode = false;
+static int64_t s_frame_period_us = 1000000 / DISPLAY_DEFAULT_FPS;
+static int64_t s_next_frame_us = 0;
+
+static atomic_int s_capture_pending;
+static host_capture_cb_t s_capture_cb;
+
+void host_display_set_size(int width, int height) {
+    s_width = width;
+    s_height = height;
+}
+
+const uint8_t *host_display_framebuffer(void) {
+    return s_fb;
+}
+
+int host_display_get_brightness(void) {
+    return s_brightness;
+}
+
+void host_display_set_capture_cb(host_capture_cb_t cb) {
+    s_capture_cb = cb;
+}
+
+void host_display_request_capture(void) {
+    atomic_store_explicit(&s_capture_pending, 1, memory_order_relaxed);
+}
+
+// Called at the top of every drawing entry point - a single relaxed load
+// unless the capture thread has asked for a frame.
+static inline void poll_capture(void) {
+    if (atomic_load_explicit(&s_capture_pending, memory_order_relaxed)) {
+        atomic_store_explicit(&s_capture_pending, 0, memory_order_relaxed);
+        if (s_capture_cb) {
+            s_capture_cb();
+        }
+    }
+}
+
+int host_display_write_ppm(const char *path) {
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        ESP_LOGE(TAG, "Failed to open %s for writing", path);
+        return -1;
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", s_width, s_height);
+    size_t len = (size_t)s_width * s_height * 3;
+    size_t written = fwrite(s_fb, 1, len, fp);
+    fclose(fp);
+    return (written == len) ? 0 : -1;
+}
+
+static inline void put_pixel(int x, int y, int r, int g, int b) {
+    uint8_t *p = s_draw + ((size_t)y * s_width + x) * 3;
+    p[0] = r;
+    p[1] = g;
+    p[2] = b;
+}
+
+void display_init(void) {
+    s_fb = calloc((size_t)s_width * s_height, 3);
+    s_back = calloc((size_t)s_width * s_height, 3);
+    if (s_fb == NULL || s_back == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %dx%d framebuffer", s_width, s_height);
+        abort();
+    }
+    s_draw = s_fb;
+    ESP_LOGI(TAG, "Virtual panel %dx%d", s_width, s_height);
+}
+
+uint8_t *display_canvas(void) {
+    // Every primitive fetches the canvas first, which makes this a good
+    // place to take pending captures
+    poll_capture();
+    return s_draw;
+}
+
+void display_mark_dirty(int x, int y, int w, int h) {
+    // Nothing to flush - the canvas is the framebuffer
+    (void)x; (void)y; (void)w; (void)h;
+}
+
+void clear_display(void) {
+    poll_capture();
+    memset(s_draw, 0, (size_t)s_width * s_height * 3);
+}
+
+bool display_begin_frame(void) {
+    if (!s_frame_mode) {
+        s_frame_mode = true;
+        s_draw = s_back;
+        s_next_frame_us = esp_timer_get_time();
+    }
+    memset(s_draw, 0, (size_t)s_width * s_height * 3);
+    return true;
+}
+
+void display_present(void) {
+    if (!s_frame_mode) {
+        return;
+    }
+
+    // Same pacing as the device
+    if (s_frame_period_us > 0) {
+        s_next_frame_us += s_frame_period_us;
+        int64_t now = esp_timer_get_time();
+        int64_t wait_us = s_next_frame_us - now;
+        if (wait_us < -s_frame_period_us) {
+            s_next_frame_us = now;
+        } else if (wait_us >= portTICK_PERIOD_MS * 1000) {
+            vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+        }
+    }
+
+    uint8_t *shown = s_draw;
+    s_draw = s_fb;
+    s_fb = shown;
+    s_back = s_draw;
+    poll_capture();
+}
+
+void display_set_target_fps(int fps) {
+    s_frame_period_us = (fps > 0) ? 1000000 / fps : 0;
+}
+
+int64_t display_frame_deadline(void) {
+    if (!s_frame_mode || s_frame_period_us <= 0) {
+        return 0;
+    }
+    return s_next_frame_us + s_frame_period_us;
+}
+
+void display_end_frames(void) {
+    if (s_frame_mode) {
+        s_frame_mode = false;
+        s_draw = s_fb;
+    }
+    s_frame_period_us = 1000000 / DISPLAY_DEFAULT_FPS;
+}
+
+void set_pixel(int x, int y, int r, int g, int b) {
+    poll_capture();
+    if (x < 0 || y < 0 || x >= s_width || y >= s_height) return;
+    put_pixel(x, y, r, g, b);
+}
+
+void fill_rect(int x, int y, int w, int h, int r, int g, int b) {
+    poll_capture();
+    // Clip to the panel like the driver does
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > s_width) w = s_width - x;
+    if (y + h > s_height) h = s_height - y;
+    if (w <= 0 || h <= 0) return;
+
+    for (int row = y; row < y + h; row++) {
+        for (int col = x; col < x + w; col++) {
+            put_pixel(col, row, r, g, b);
+        }
+    }
+}
+
+void vert_line(int x, int y, int len, int r, int g, int b) {
+    fill_rect(x, y, 1, len, r, g, b);
+}
+
+void horiz_line(int x, int y, int len, int r, int g, int b) {
+    fill_rect(x, y, len, 1, r, g, b);
+}
+
+void set_brightness(int b) {
+    s_brightness = b;
+}
+
+int get_width(void) {
+    return s_width;
+}
+
+int get_height(void) {
+    return s_height;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdint.h>
+
+// Host-only extensions to the display API in display.h. The virtual panel
+// is a plain RGB888 buffer, row-major, 3 bytes per pixel.
+
+// Must be called before display_init(). Defaults to the 192x64 layout
+// display_init() configures on the device.
+void host_display_set_size(int width, int height);
+
+const uint8_t *host_display_framebuffer(void);
+int host_display_get_brightness(void);
+
+// Write the current framebuffer as a binary PPM (P6). Returns 0 on success.
+int host_display_write_ppm(const char *path);
+
+// Frame capture: host_display_request_capture() may be called from any
+// thread. The callback runs on the drawing thread at the next display
+// call, so it always sees a framebuffer that is not being modified.
+typedef void (*host_capture_cb_t)(void);
+void host_display_set_capture_cb(host_capture_cb_t cb);
+void host_display_request_capture(void);
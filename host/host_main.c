@@ -0,0 +1,121 @@
+// Headless runner for the host build. Runs a script from LUA_FILE_PATH
+// against the virtual panel and dumps frames as PPM files.
+
+#include "display.h"
+#include "host_display.h"
+#include "host_port.h"
+#include "local_lua.h"
+#include "esp_log.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static const char *s_out_dir = "frames";
+static int s_max_frames = 10;
+static int s_interval_ms = 1000;
+static int s_frame_count = 0;
+static volatile bool s_done = false;
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [options] [script]\n"
+        "  -o DIR    write frames to DIR (default: frames)\n"
+        "  -n COUNT  stop after COUNT frames (default: 10)\n"
+        "  -i MS     capture a frame every MS milliseconds (default: 1000)\n"
+        "  -s WxH    panel size (default: 192x64)\n"
+        "  -q        only log errors\n"
+        "  -v        debug logging\n"
+        "The script is looked up in " LUA_FILE_PATH " (default: display.lua)\n",
+        prog);
+}
+
+static void save_frame(void) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/frame_%04d.ppm", s_out_dir, s_frame_count);
+    if (host_display_write_ppm(path) == 0) {
+        ESP_LOGI("host", "Wrote %s", path);
+    }
+    s_frame_count++;
+}
+
+// Runs on the drawing thread via host_display_request_capture()
+static void capture_cb(void) {
+    if (s_done) return;
+    save_frame();
+    if (s_frame_count >= s_max_frames) {
+        s_done = true;
+        host_port_set_exiting();
+        lua_request_exit();
+    }
+}
+
+static void *capture_thread(void *arg) {
+    (void)arg;
+    struct timespec ts = {
+        .tv_sec = s_interval_ms / 1000,
+        .tv_nsec = (long)(s_interval_ms % 1000) * 1000000L,
+    };
+    while (!s_done) {
+        nanosleep(&ts, NULL);
+        host_display_request_capture();
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int width = 64 * 3;
+    int height = 64;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:n:i:s:qvh")) != -1) {
+        switch (opt) {
+            case 'o': s_out_dir = optarg; break;
+            case 'n': s_max_frames = atoi(optarg); break;
+            case 'i': s_interval_ms = atoi(optarg); break;
+            case 's':
+                if (sscanf(optarg, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                    usage(argv[0]);
+                    return 2;
+                }
+                break;
+            case 'q': host_log_level = 0; break;
+            case 'v': host_log_level = 3; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 2;
+        }
+    }
+    if (s_max_frames < 1 || s_interval_ms < 1) {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *script = (optind < argc) ? argv[optind] : "display.lua";
+
+    if (mkdir(s_out_dir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", s_out_dir, strerror(errno));
+        return 1;
+    }
+
+    host_display_set_size(width, height);
+    display_init();
+    host_display_set_capture_cb(capture_cb);
+
+    pthread_t tid;
+    pthread_create(&tid, NULL, capture_thread, NULL);
+
+    run_lua_file(script);
+
+    // Script finished on its own - keep its final image
+    if (!s_done) {
+        s_done = true;
+        save_frame();
+    }
+    pthread_join(tid, NULL);
+    return 0;
+}
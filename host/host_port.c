@@ -0,0 +1,395 @@
+// Minimal host implementations of the ESP-IDF, FreeRTOS and luaMatrix
+// services that luafuncs.c and local_lua.c depend on.
+
+#include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "luamatrix_mqtt.h"
+#include "host_port.h"
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Pretend heap size reported to the memory logging in local_lua.c
+#define HOST_HEAP_SIZE (4 * 1024 * 1024)
+
+int host_log_level = 2;
+
+static atomic_bool s_exiting;
+
+void host_port_set_exiting(void) {
+    atomic_store(&s_exiting, true);
+}
+
+// ============================================================================
+// ESP-IDF core
+// ============================================================================
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+void host_log(char level, const char *tag, const char *fmt, ...) {
+    va_list args;
+    fprintf(stderr, "%c (%lld) %s: ", level, (long long)(esp_timer_get_time() / 1000), tag);
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+int64_t esp_timer_get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    (void)caps;
+    return malloc(size);
+}
+
+void *heap_caps_realloc(void *ptr, size_t size, uint32_t caps) {
+    (void)caps;
+    return realloc(ptr, size);
+}
+
+void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps) {
+    (void)caps;
+    return aligned_alloc(alignment, size);
+}
+
+void heap_caps_free(void *ptr) {
+    free(ptr);
+}
+
+size_t heap_caps_get_total_size(uint32_t caps) {
+    return (caps & MALLOC_CAP_SPIRAM) ? 0 : HOST_HEAP_SIZE;
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    (void)caps;
+    return HOST_HEAP_SIZE;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    (void)caps;
+    return HOST_HEAP_SIZE;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) {
+    (void)caps;
+    return HOST_HEAP_SIZE;
+}
+
+// ============================================================================
+// FreeRTOS
+// ============================================================================
+
+// Set on threads started by xTaskCreate(). Only the Lua thread has its
+// delays cut short when exiting; background tasks keep their pace.
+static __thread bool s_is_task;
+
+void vTaskDelay(TickType_t ticks) {
+    if ((atomic_load(&s_exiting) && !s_is_task) || ticks == 0) {
+        return;
+    }
+    struct timespec ts = {
+        .tv_sec = ticks / configTICK_RATE_HZ,
+        .tv_nsec = (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ),
+    };
+    nanosleep(&ts, NULL);
+}
+
+typedef struct {
+    TaskFunction_t fn;
+    void *arg;
+} host_task_t;
+
+static void *task_thread(void *p) {
+    host_task_t task = *(host_task_t *)p;
+    free(p);
+    s_is_task = true;
+    task.fn(task.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                       void *arg, UBaseType_t priority, TaskHandle_t *handle) {
+    (void)name; (void)stack_depth; (void)priority;
+    host_task_t *task = malloc(sizeof(*task));
+    if (task == NULL) return pdFAIL;
+    task->fn = fn;
+    task->arg = arg;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, task_thread, task) != 0) {
+        free(task);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (handle) *handle = (TaskHandle_t)thread;
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth,
+                                   void *arg, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core_id) {
+    (void)core_id;
+    return xTaskCreate(fn, name, stack_depth, arg, priority, handle);
+}
+
+TaskHandle_t xTaskGetHandle(const char *name) {
+    (void)name;
+    return NULL;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task) {
+    (void)task;
+    return 0;
+}
+
+struct host_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool given;
+};
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    SemaphoreHandle_t sem = calloc(1, sizeof(*sem));
+    if (sem == NULL) return NULL;
+    pthread_mutex_init(&sem->lock, NULL);
+    pthread_cond_init(&sem->cond, NULL);
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t sem = xSemaphoreCreateBinary();
+    if (sem != NULL) sem->given = true;
+    return sem;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) {
+    pthread_mutex_lock(&sem->lock);
+    bool was_given = sem->given;
+    sem->given = true;
+    pthread_cond_signal(&sem->cond);
+    pthread_mutex_unlock(&sem->lock);
+    return was_given ? pdFAIL : pdPASS;
+}
+
+static struct timespec deadline_after(TickType_t ticks) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += ticks / configTICK_RATE_HZ;
+    deadline.tv_nsec += (long)(ticks % configTICK_RATE_HZ) * (1000000000L / configTICK_RATE_HZ);
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) {
+    struct timespec deadline = deadline_after(ticks);
+
+    pthread_mutex_lock(&sem->lock);
+    while (!sem->given && ticks != 0) {
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&sem->cond, &sem->lock);
+        } else if (pthread_cond_timedwait(&sem->cond, &sem->lock, &deadline) != 0) {
+            break;
+        }
+    }
+    bool taken = sem->given;
+    sem->given = false;
+    pthread_mutex_unlock(&sem->lock);
+    return taken ? pdPASS : pdFAIL;
+}
+
+struct host_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t items[];
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+    QueueHandle_t queue = calloc(1, sizeof(*queue) + (size_t)length * item_size);
+    if (queue == NULL) return NULL;
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->changed, NULL);
+    queue->length = length;
+    queue->item_size = item_size;
+    return queue;
+}
+
+// Waits until the queue has an item (want_items) or a free slot, at most
+// ticks; called with the lock held
+static bool queue_wait(QueueHandle_t queue, TickType_t ticks, bool want_items) {
+    struct timespec deadline = deadline_after(ticks);
+    while (want_items ? queue->count == 0 : queue->count == queue->length) {
+        if (ticks == 0) return false;
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(&queue->changed, &queue->lock);
+        } else if (pthread_cond_timedwait(&queue->changed, &queue->lock, &deadline) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+    pthread_mutex_lock(&queue->lock);
+    bool ok = queue_wait(queue, ticks, false);
+    if (ok) {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->items + (size_t)tail * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ok ? pdPASS : pdFAIL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+    pthread_mutex_lock(&queue->lock);
+    bool ok = queue_wait(queue, ticks, true);
+    if (ok) {
+        memcpy(item, queue->items + (size_t)queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return ok ? pdPASS : pdFAIL;
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / (1000000 / configTICK_RATE_HZ));
+}
+
+// ============================================================================
+// MQTT - never connected on the host
+// ============================================================================
+
+bool mqtt_client_is_connected(void) {
+    return false;
+}
+
+esp_err_t mqtt_publish(const char *topic, const char *data, int qos, int retain) {
+    (void)data; (void)qos; (void)retain;
+    ESP_LOGW("mqtt", "MQTT not connected, cannot publish to %s", topic);
+    return ESP_FAIL;
+}
+
+bool mqtt_get_pending_message(char *topic, size_t tlen, char *data, size_t dlen) {
+    (void)topic; (void)tlen; (void)data; (void)dlen;
+    return false;
+}
+
+bool mqtt_take_message(bool (*match)(const char *topic, void *arg), void *arg,
+                       char *topic, size_t tlen, char *data, size_t dlen) {
+    (void)match; (void)arg; (void)topic; (void)tlen; (void)data; (void)dlen;
+    return false;
+}
+
+bool mqtt_wait_for_message(char *topic, size_t tlen, char *data, size_t dlen, uint32_t timeout_ms) {
+    (void)topic; (void)tlen; (void)data; (void)dlen;
+    // Same contract as the device: 0 waits forever, which on the host
+    // would hang the run, so treat it as a one second wait.
+    vTaskDelay(pdMS_TO_TICKS(timeout_ms ? timeout_ms : 1000));
+    return false;
+}
+
+// ============================================================================
+// HTTP client - no network stack on the host
+// ============================================================================
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config) {
+    (void)config;
+    return NULL;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url) {
+    (void)client; (void)url;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_timeout_ms(esp_http_client_handle_t client, int timeout_ms) {
+    (void)client; (void)timeout_ms;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_user_data(esp_http_client_handle_t client, void *data) {
+    (void)client; (void)data;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_delete_header(esp_http_client_handle_t client, const char *key) {
+    (void)client; (void)key;
+    return ESP_OK;
+}
+
+bool esp_http_client_is_complete_data_received(esp_http_client_handle_t client) {
+    (void)client;
+    return false;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value) {
+    (void)client; (void)key; (void)value;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len) {
+    (void)client; (void)write_len;
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client) {
+    (void)client;
+    return -1;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len) {
+    (void)client; (void)buffer; (void)len;
+    return -1;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+    (void)client;
+    return 0;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+    (void)client;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+    (void)client;
+    return ESP_OK;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+// Host-side runtime shared between host_main.c and the ESP-IDF/FreeRTOS
+// stand-ins in host_port.c.
+
+// Once set, vTaskDelay() returns immediately so the firmware's error
+// screen delays don't hold up a finished run.
+void host_port_set_exiting(void);
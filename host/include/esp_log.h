@@ -0,0 +1,23 @@
+#pragma once
+// Host stand-in for ESP-IDF logging - everything goes to stderr
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// 0 = errors only, 1 = + warnings, 2 = + info, 3 = + debug
+extern int host_log_level;
+
+void host_log(char level, const char *tag, const char *fmt, ...)
+    __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, fmt, ...) host_log('E', tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) do { if (host_log_level >= 1) host_log('W', tag, fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGI(tag, fmt, ...) do { if (host_log_level >= 2) host_log('I', tag, fmt, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, fmt, ...) do { if (host_log_level >= 3) host_log('D', tag, fmt, ##__VA_ARGS__); } while (0)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,10 @@
+#pragma once
+// Host stand-in for the ESP-IDF address range checks. The host has no
+// external RAM.
+
+#include <stdbool.h>
+
+static inline bool esp_ptr_external_ram(const void *p) {
+    (void)p;
+    return false;
+}
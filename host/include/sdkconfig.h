@@ -0,0 +1,20 @@
+#pragma once
+// Host stand-in for the generated sdkconfig.h - only the options the shared
+// sources read, with the values from sdkconfig
+
+#define CONFIG_LWIP_MAX_SOCKETS 10
+
+// main/Kconfig.projbuild defaults
+#define CONFIG_LUAMATRIX_LUA_CORE 1
+#define CONFIG_LUAMATRIX_LUA_PRIORITY 2
+#define CONFIG_LUAMATRIX_LUA_STACK 32768
+#define CONFIG_LUAMATRIX_LUA_MEM_LIMIT_KB 0
+#define CONFIG_LUAMATRIX_FLUSH_PRIORITY 3
+#define CONFIG_LUAMATRIX_FLUSH_STACK 3072
+#define CONFIG_LUAMATRIX_HTTPD_PRIORITY 5
+#define CONFIG_LUAMATRIX_MQTT_PRIORITY 5
+#define CONFIG_LUAMATRIX_MQTT_STACK 6144
+#define CONFIG_LUAMATRIX_HTTP_WORKER_PRIORITY 3
+#define CONFIG_LUAMATRIX_HTTP_WORKER_STACK 8192
+#define CONFIG_LUAMATRIX_MEMWATCH_STACK 3072
+#define CONFIG_LUAMATRIX_STACK_REPORT_MS 60000
@@ -0,0 +1,283 @@
+// Checks main/raster.c against the per-pixel shape code it replaced: random
+// lines, circles and triangles, on the panel, across its edges and far off
+// it, are drawn both ways and the canvases compared byte for byte.
+//
+//   ./build-host/raster_test [iterations] [seed]
+
+#include "display.h"
+#include "host_display.h"
+#include "raster.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WIDTH (64 * 3)
+#define HEIGHT 64
+
+// ============================================================================
+// Reference implementations, as they were in luafuncs.c
+// ============================================================================
+
+// Bresenham's line algorithm
+static void ref_line(int x0, int y0, int x1, int y1, int r, int g, int b) {
+    int dx = abs(x1 - x0);
+    int dy = -abs(y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+
+    while (1) {
+        set_pixel(x0, y0, r, g, b);
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            x0 += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            y0 += sy;
+        }
+    }
+}
+
+// Midpoint circle algorithm
+static void ref_circle(int cx, int cy, int radius, int r, int g, int b) {
+    int x = radius;
+    int y = 0;
+    int d = 1 - radius;
+
+    while (x >= y) {
+        set_pixel(cx + x, cy + y, r, g, b);
+        set_pixel(cx - x, cy + y, r, g, b);
+        set_pixel(cx + x, cy - y, r, g, b);
+        set_pixel(cx - x, cy - y, r, g, b);
+        set_pixel(cx + y, cy + x, r, g, b);
+        set_pixel(cx - y, cy + x, r, g, b);
+        set_pixel(cx + y, cy - x, r, g, b);
+        set_pixel(cx - y, cy - x, r, g, b);
+
+        y++;
+        if (d < 0) {
+            d += 2 * y + 1;
+        } else {
+            x--;
+            d += 2 * (y - x) + 1;
+        }
+    }
+}
+
+// Filled circle using horizontal lines
+static void ref_filled_circle(int cx, int cy, int radius, int r, int g, int b) {
+    int x = radius;
+    int y = 0;
+    int d = 1 - radius;
+
+    while (x >= y) {
+        horiz_line(cx - x, cy + y, 2 * x + 1, r, g, b);
+        horiz_line(cx - x, cy - y, 2 * x + 1, r, g, b);
+        horiz_line(cx - y, cy + x, 2 * y + 1, r, g, b);
+        horiz_line(cx - y, cy - x, 2 * y + 1, r, g, b);
+
+        y++;
+        if (d < 0) {
+            d += 2 * y + 1;
+        } else {
+            x--;
+            d += 2 * (y - x) + 1;
+        }
+    }
+}
+
+static void swap_int(int *a, int *b) {
+    int t = *a; *a = *b; *b = t;
+}
+
+// Filled triangle using scanline algorithm
+static void ref_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int r, int g, int b) {
+    // Sort vertices by y-coordinate (y0 <= y1 <= y2)
+    if (y0 > y1) { swap_int(&y0, &y1); swap_int(&x0, &x1); }
+    if (y1 > y2) { swap_int(&y1, &y2); swap_int(&x1, &x2); }
+    if (y0 > y1) { swap_int(&y0, &y1); swap_int(&x0, &x1); }
+
+    if (y0 == y2) {
+        // Degenerate case - horizontal line
+        int minx = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
+        int maxx = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
+        horiz_line(minx, y0, maxx - minx + 1, r, g, b);
+        return;
+    }
+
+    // Fill using horizontal lines
+    for (int y = y0; y <= y2; y++) {
+        int xa, xb;
+
+        if (y < y1) {
+            // Upper part of triangle
+            xa = x0 + (x1 - x0) * (y - y0) / (y1 - y0);
+            xb = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
+        } else {
+            // Lower part of triangle
+            if (y1 == y2) {
+                xa = x1;
+            } else {
+                xa = x1 + (x2 - x1) * (y - y1) / (y2 - y1);
+            }
+            xb = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
+        }
+
+        if (xa > xb) swap_int(&xa, &xb);
+        horiz_line(xa, y, xb - xa + 1, r, g, b);
+    }
+}
+
+// ============================================================================
+// Test driver
+// ============================================================================
+
+enum { SHAPE_LINE, SHAPE_CIRCLE, SHAPE_FILLED_CIRCLE, SHAPE_TRIANGLE, SHAPE_FILLED_TRIANGLE, SHAPE_COUNT };
+
+static const char *const s_shape_names[SHAPE_COUNT] = {
+    "line", "circle", "filled circle", "triangle", "filled triangle",
+};
+
+typedef struct {
+    int shape;
+    int v[6];       // x0, y0, x1, y1, x2, y2 or cx, cy, radius
+    int r, g, b;
+} shape_t;
+
+static uint32_t s_rng;
+
+// xorshift32 - the same seed gives the same shapes on every platform
+static uint32_t rnd(void) {
+    s_rng ^= s_rng << 13;
+    s_rng ^= s_rng >> 17;
+    s_rng ^= s_rng << 5;
+    return s_rng;
+}
+
+static int rnd_range(int lo, int hi) {
+    return lo + (int)(rnd() % (uint32_t)(hi - lo + 1));
+}
+
+// Mostly around the panel, sometimes well off it. Far coordinates are kept
+// small enough that the reference triangle's products fit in an int.
+static int rnd_coord(int size) {
+    switch (rnd() % 4) {
+        case 0: return rnd_range(-4000, 4000);
+        case 1: return rnd_range(-size, 2 * size);
+        default: return rnd_range(-8, size + 8);
+    }
+}
+
+static void draw_shape(const shape_t *s, bool reference) {
+    const int *v = s->v;
+    switch (s->shape) {
+        case SHAPE_LINE:
+            (reference ? ref_line : raster_line)(v[0], v[1], v[2], v[3], s->r, s->g, s->b);
+            break;
+        case SHAPE_CIRCLE:
+            (reference ? ref_circle : raster_circle)(v[0], v[1], v[2], s->r, s->g, s->b);
+            break;
+        case SHAPE_FILLED_CIRCLE:
+            (reference ? ref_filled_circle : raster_filled_circle)(v[0], v[1], v[2], s->r, s->g, s->b);
+            break;
+        case SHAPE_TRIANGLE: {
+            // draw_triangle() in luafuncs.c, then and now
+            void (*line)(int, int, int, int, int, int, int) = reference ? ref_line : raster_line;
+            line(v[0], v[1], v[2], v[3], s->r, s->g, s->b);
+            line(v[2], v[3], v[4], v[5], s->r, s->g, s->b);
+            line(v[4], v[5], v[0], v[1], s->r, s->g, s->b);
+            break;
+        }
+        case SHAPE_FILLED_TRIANGLE:
+            (reference ? ref_filled_triangle : raster_filled_triangle)(
+                v[0], v[1], v[2], v[3], v[4], v[5], s->r, s->g, s->b);
+            break;
+    }
+}
+
+static void random_shape(shape_t *s) {
+    s->shape = (int)(rnd() % SHAPE_COUNT);
+    for (int i = 0; i < 6; i += 2) {
+        s->v[i] = rnd_coord(WIDTH);
+        s->v[i + 1] = rnd_coord(HEIGHT);
+    }
+    // Degenerate cases the random coordinates would almost never hit:
+    // flat and vertical edges, and vertices on top of each other
+    switch (rnd() % 8) {
+        case 0: s->v[3] = s->v[1]; break;
+        case 1: s->v[3] = s->v[5] = s->v[1]; break;
+        case 2: s->v[2] = s->v[0]; break;
+        case 3: s->v[4] = s->v[2]; s->v[5] = s->v[3]; break;
+    }
+    if (s->shape == SHAPE_CIRCLE || s->shape == SHAPE_FILLED_CIRCLE) {
+        // Radius: mostly panel sized, sometimes huge, now and then negative
+        switch (rnd() % 8) {
+            case 0: s->v[2] = rnd_range(-4, 0); break;
+            case 1: s->v[2] = rnd_range(0, 3000); break;
+            default: s->v[2] = rnd_range(0, 100); break;
+        }
+    }
+    // Never black, so every drawn pixel differs from the cleared canvas
+    s->r = rnd_range(1, 255);
+    s->g = rnd_range(0, 255);
+    s->b = rnd_range(0, 255);
+}
+
+static void report(const shape_t *s, long n, const uint8_t *want, const uint8_t *got) {
+    size_t i = 0;
+    while (want[i] == got[i]) i++;
+    int x = (int)(i / 3 % WIDTH);
+    int y = (int)(i / 3 / WIDTH);
+    fprintf(stderr, "Shape %ld (%s %d %d %d %d %d %d) differs first at %d,%d: "
+        "expected %02x%02x%02x, got %02x%02x%02x\n",
+        n, s_shape_names[s->shape], s->v[0], s->v[1], s->v[2], s->v[3], s->v[4], s->v[5], x, y,
+        want[i - i % 3], want[i - i % 3 + 1], want[i - i % 3 + 2],
+        got[i - i % 3], got[i - i % 3 + 1], got[i - i % 3 + 2]);
+}
+
+int main(int argc, char **argv) {
+    long iterations = argc > 1 ? atol(argv[1]) : 200000;
+    s_rng = argc > 2 ? (uint32_t)strtoul(argv[2], NULL, 0) : 0x2545f491u;
+    if (s_rng == 0) s_rng = 1;
+
+    host_display_set_size(WIDTH, HEIGHT);
+    display_init();
+
+    size_t canvas_bytes = (size_t)WIDTH * HEIGHT * 3;
+    uint8_t *want = malloc(canvas_bytes);
+    if (want == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    long failures = 0;
+    long counts[SHAPE_COUNT] = {0};
+    for (long n = 0; n < iterations; n++) {
+        shape_t s;
+        random_shape(&s);
+        counts[s.shape]++;
+
+        clear_display();
+        draw_shape(&s, true);
+        memcpy(want, display_canvas(), canvas_bytes);
+
+        clear_display();
+        draw_shape(&s, false);
+        if (memcmp(want, display_canvas(), canvas_bytes) != 0) {
+            if (failures++ < 10) {
+                report(&s, n, want, display_canvas());
+            }
+        }
+    }
+
+    for (int i = 0; i < SHAPE_COUNT; i++) {
+        printf("%-16s %ld\n", s_shape_names[i], counts[i]);
+    }
+    printf("%ld of %ld shapes differ\n", failures, iterations);
+    free(want);
+    return failures ? 1 : 0;
+}
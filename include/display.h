@@ -1,6 +1,9 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -15,6 +18,32 @@ void fill_rect(int x, int y, int w, int h, int r, int g, int b);
 int get_width(void);
 int get_height(void);
 void set_brightness(int b);
+
+// Direct access to the drawing canvas for the rasterizer: RGB888,
+// row-major, get_width() * 3 bytes per row. Anything written here must be
+// reported with display_mark_dirty() to reach the panel.
+uint8_t *display_canvas(void);
+void display_mark_dirty(int x, int y, int w, int h);
+
+// Frame mode: while a script draws in frames, drawing goes to a hidden
+// back buffer and display_present() swaps it onto the panel in one go.
+
+// Frame rate display_present() paces to until a script sets its own
+#define DISPLAY_DEFAULT_FPS 30
+
+// Enter frame mode (first call) and clear the back buffer. Returns false if
+// the second buffer could not be allocated and frames go straight to the
+// panel, where they may show partly drawn.
+bool display_begin_frame(void);
+// Wait for the next frame slot, then show the back buffer
+void display_present(void);
+// fps <= 0 disables pacing
+void display_set_target_fps(int fps);
+// esp_timer time at which the next display_present() will show its frame,
+// 0 outside frame mode or without pacing
+int64_t display_frame_deadline(void);
+// Back to drawing straight onto the panel, e.g. when a script ends
+void display_end_frames(void);
                    
 #ifdef __cplusplus
 }
@@ -0,0 +1,53 @@
+#pragma once
+
+// Loadable bitmap fonts (.lmf) stored in the assets filesystem.
+//
+// File layout, all integers little-endian:
+//
+//   header   "LMF1"  magic
+//            u8      height         line height in pixels (<= 32)
+//            u8      flags          bit 0: 4-bit coverage bitmaps
+//            u16     range_count
+//            u32     glyph_count
+//            u32     fallback       glyph index drawn for unmapped codepoints
+//   ranges   range_count x { u32 first_codepoint, u16 count, u16 reserved,
+//                            u32 first_glyph }
+//   glyphs   glyph_count x { u32 bitmap_offset, u8 width, u8 advance,
+//                            u8 top, u8 rows }
+//   bitmaps  rows x ceil(width / 8) bytes per glyph, bit 0 of the first
+//            byte is the leftmost pixel. Coverage fonts use
+//            rows x ceil(width / 2) bytes instead, one 4-bit alpha value
+//            per pixel with the low nibble leftmost.
+//
+// Ranges must be sorted by codepoint. Only the header and range table are
+// kept in RAM; glyph metrics and bitmaps are read on demand through a small
+// LRU cache shared by all open fonts. tools/bdf2lmf.py converts BDF fonts.
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct font font_t;
+
+// Returns the font stored as LUA_FILE_PATH/<name>, opening it on first use.
+// NULL if the file is missing or not a valid font.
+font_t *font_get(const char *name);
+
+int font_height(const font_t *font);
+
+// Draws UTF-8 text with the top-left corner at x, y. Drawing stops at the
+// right edge of the panel; use font_text_width() for layout.
+void font_draw_string(font_t *font, const char *str, int x, int y, int r, int g, int b);
+
+// Advance width of UTF-8 text in pixels
+int font_text_width(font_t *font, const char *str);
+
+// Closes every open font and drops cached glyphs, so fonts replaced on the
+// filesystem are picked up by the next script
+void font_close_all(void);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,31 @@
+#pragma once
+
+// Frame-synchronised garbage collection. While a script draws in paced
+// frames the VM uses the incremental collector, and present() spends the
+// time left before the frame's deadline on collector steps. The work that
+// would otherwise land in the middle of drawing happens while the script
+// would be waiting anyway.
+
+#include <stdbool.h>
+
+struct lua_State;
+
+// Called from begin_frame(): switches the VM to incremental collection
+void frame_gc_begin(struct lua_State *L);
+
+// Called from present() before the frame is shown
+void frame_gc_run(struct lua_State *L);
+
+// True while the VM runs the incremental collector for paced frames
+bool frame_gc_incremental(void);
+
+// Logs the script's frame stats and restores the defaults; the VM's
+// collector mode is reset with the VM itself
+void frame_gc_reset(void);
+
+// set_frame_gc(on) - collect in the frame slack (default) or leave the
+// collector in generational mode
+int lua_set_frame_gc(struct lua_State *LUA);
+
+// frame_stats() - table with per-frame GC time and remaining slack
+int lua_frame_stats(struct lua_State *LUA);
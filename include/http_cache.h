@@ -0,0 +1,73 @@
+#pragma once
+
+// Response cache for http_fetch(). Small bodies stay in a RAM LRU of
+// HTTP_CACHE_RAM_ENTRIES; every cacheable response is also written to
+// HTTP_CACHE_DIR so it survives a reboot. An entry is used without asking
+// the server while its Cache-Control max-age lasts; after that the next
+// fetch sends If-None-Match / If-Modified-Since and a 304 answer reuses
+// the stored body.
+//
+// There is no SNTP on the board, so max-age is measured with esp_timer for
+// entries in RAM. Entries read back from flash after a reboot are only
+// trusted if the wall clock has been set; otherwise they are revalidated,
+// which costs a request but no body.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "local_lua.h"
+
+#define HTTP_CACHE_DIR LUA_FILE_PATH "/.cache"
+
+#ifndef HTTP_CACHE_RAM_ENTRIES
+#define HTTP_CACHE_RAM_ENTRIES 8
+#endif
+
+// Largest body kept in RAM; bigger ones are only stored in flash
+#ifndef HTTP_CACHE_RAM_MAX_BODY
+#define HTTP_CACHE_RAM_MAX_BODY 2048
+#endif
+
+// Flash used by HTTP_CACHE_DIR before other entries are dropped
+#ifndef HTTP_CACHE_DISK_MAX
+#define HTTP_CACHE_DISK_MAX (64 * 1024)
+#endif
+
+typedef enum {
+    HTTP_CACHE_BYPASS,      // not consulted
+    HTTP_CACHE_MISS,        // body came from the server
+    HTTP_CACHE_HIT,         // fresh entry, no request made
+    HTTP_CACHE_REVALIDATED, // server answered 304 for the stored body
+} http_cache_status_t;
+
+// Caching headers of a response
+typedef struct {
+    char etag[64];
+    char last_modified[40];
+    int32_t max_age;        // seconds, -1 if not given; 0 if no-cache
+    bool no_store;
+    bool no_cache;          // always revalidate, whatever max-age says
+} http_cache_meta_t;
+
+typedef struct {
+    http_cache_meta_t meta;
+    bool fresh;             // usable without a request
+    char *body;             // malloc'd copy, owned by the caller
+    int len;
+} http_cache_entry_t;
+
+// Creates the lock; called from the Lua task before any fetch
+void http_cache_init(void);
+
+void http_cache_meta_init(http_cache_meta_t *meta);
+
+// Feeds one response header (HTTP_EVENT_ON_HEADER) into meta
+void http_cache_on_header(http_cache_meta_t *meta, const char *key, const char *value);
+
+// Finds url in RAM, then in flash. Returns false if it is not cached.
+bool http_cache_lookup(const char *url, http_cache_entry_t *entry);
+
+// Stores a 200 response, or refreshes an entry after a 304. Responses
+// marked no-store, or without max-age and validators, are not kept.
+void http_cache_store(const char *url, const http_cache_meta_t *meta, const char *body, int len);
+
+const char *http_cache_status_name(http_cache_status_t status);
@@ -0,0 +1,41 @@
+#pragma once
+
+// HTTP GET for scripts. http_fetch() runs the request on the Lua task;
+// http_fetch_async() hands it to a network worker task through a bounded
+// queue and returns a future right away, so drawing goes on meanwhile.
+//
+// Future methods:
+//   f:ready()           true once the request has finished
+//   f:result()          body, status, cache - or nil, error message;
+//                       nil, "pending" while the request is still running
+//   f:await([timeout])  waits for the result (timeout in ms), letting the
+//                       other tasks run; nil, "timeout" if it expires
+
+// Longest response body kept, unless opts.max_size says otherwise. Larger
+// downloads go through http_stream().
+#define HTTP_FETCH_MAX_SIZE 8192
+
+// Requests that may wait for the worker before http_fetch_async() refuses
+#ifndef HTTP_FETCH_QUEUE_LEN
+#define HTTP_FETCH_QUEUE_LEN 8
+#endif
+
+struct lua_State;
+
+// Both functions go through the response cache (see http_cache.h) and
+// report how it answered as "hit", "miss", "revalidated" or "bypass".
+// opts: timeout (ms), max_size (bytes), cache (false to skip the cache)
+
+// http_fetch(url[, opts]) - returns the body (nil on error) and the cache status
+int lua_http_fetch(struct lua_State *LUA);
+
+// http_fetch_async(url[, opts]) - returns a future, or nil and an error if
+// the queue is full
+int lua_http_fetch_async(struct lua_State *LUA);
+
+// http_stream(url, sink[, opts]) - passes the body to sink without holding
+// it in memory. sink is a function called with each chunk (returning false
+// stops the download), or a file name under LUA_FILE_PATH that receives the
+// body once it is complete. Returns bytes, status - or nil and an error.
+// opts: timeout (ms). The cache is not used.
+int lua_http_stream(struct lua_State *LUA);
@@ -0,0 +1,45 @@
+#pragma once
+
+// Keep-alive pool for esp_http_client handles. A handle whose response was
+// read to the end goes back to the pool with its connection open, and the
+// next request to the same scheme://host:port reuses it without a TCP (or
+// TLS) handshake. Idle connections are closed after HTTP_POOL_IDLE_MS.
+//
+// lwIP has CONFIG_LWIP_MAX_SOCKETS sockets for everything: the web UI
+// server keeps its listening and control sockets plus one per client,
+// MQTT holds one, DNS lookups need one. HTTP_POOL_RESERVED_SOCKETS of them
+// are left alone, and the pool never keeps more than HTTP_POOL_MAX.
+
+#include <stdbool.h>
+#include "esp_http_client.h"
+#include "sdkconfig.h"
+
+#ifndef HTTP_POOL_RESERVED_SOCKETS
+#define HTTP_POOL_RESERVED_SOCKETS 8
+#endif
+
+#ifndef HTTP_POOL_IDLE_MS
+#define HTTP_POOL_IDLE_MS 30000
+#endif
+
+#define HTTP_POOL_SOCKETS (CONFIG_LWIP_MAX_SOCKETS - HTTP_POOL_RESERVED_SOCKETS)
+#define HTTP_POOL_MAX (HTTP_POOL_SOCKETS < 1 ? 1 : HTTP_POOL_SOCKETS > 4 ? 4 : HTTP_POOL_SOCKETS)
+
+// Creates the lock; called from the Lua task before any fetch
+void http_pool_init(void);
+
+// Returns a handle for url, an idle pooled one for the same host if there
+// is one (*reused is then set) or a new one. The handle calls
+// event_handler with user_data for this request. NULL if the client
+// can't be created.
+esp_http_client_handle_t http_pool_acquire(const char *url, int timeout_ms,
+                                           http_event_handle_cb event_handler,
+                                           void *user_data, bool *reused);
+
+// Hands the handle back. keep is false when the connection can't be
+// reused (an error, an unread body, "Connection: close"); it is then
+// closed and freed.
+void http_pool_release(esp_http_client_handle_t client, bool keep);
+
+// Closes idle connections, all of them or only those past HTTP_POOL_IDLE_MS
+void http_pool_close_idle(bool all);
@@ -1,10 +1,38 @@
 
 #pragma once
 
+// Directory scripts are loaded from. The host build points this at the
+// repository's assets/ directory instead of the LittleFS mount.
+#ifndef LUA_FILE_PATH
 #define LUA_FILE_PATH "/assets"
+#endif
+
+// Keep one Lua VM for the lifetime of the firmware and reset its globals
+// and loaded modules from a snapshot between scripts, instead of building
+// a new state for every run. Set to 0 to always start from a fresh VM.
+#ifndef LUA_WARM_RESTART
+#define LUA_WARM_RESTART 1
+#endif
+
+#include <stdint.h>
 
 void run_lua_file(const char* file_name);
 
-// Request Lua to pause execution briefly to free up CPU/memory for HTTP
-// duration_ms: how long to pause (0 to clear the request)
-void lua_request_pause(int duration_ms);
+// Signals for the running script. Any task may raise them; the Lua task
+// acts on them from its debug hook within about a tick.
+#define LUA_SIGNAL_EXIT        (1u << 0)  // abort the script so it restarts
+#define LUA_SIGNAL_LOW_MEMORY  (1u << 2)  // heap is low, yield to other tasks
+#define LUA_SIGNAL_GC          (1u << 3)  // script is near its memory budget
+
+void lua_signal(uint32_t bits);
+
+struct lua_State;
+
+// Acts on pending signals for the script running in L, raising a Lua error
+// if it has to stop. Called from the debug hook and from C code that waits
+// without running Lua code.
+void lua_check_signals(struct lua_State *L);
+
+// Stops the running script, e.g. because display.lua was replaced
+void lua_request_exit(void);
+
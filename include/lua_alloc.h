@@ -0,0 +1,106 @@
+#pragma once
+
+// Allocator for the Lua VM. Blocks up to LUA_ALLOC_MAX_SMALL bytes come
+// from fixed-size slab pools in internal RAM, so the many small strings and
+// table parts Lua creates do not scatter holes through the heap that the
+// HTTP server and MQTT client share. Larger blocks go to PSRAM when the
+// board has it and to the regular heap otherwise.
+//
+// Every byte Lua asks for is charged against a budget, and the collector
+// is pushed harder as usage approaches it:
+//
+//   LUA_ALLOC_MINOR_GC_PERCENT  the debug hook runs a minor collection
+//   LUA_ALLOC_FULL_GC_PERCENT   ... followed by a full one if still above
+//   100%                        the allocation fails, Lua collects everything
+//                               it can and retries, then raises an
+//                               out-of-memory error that ends the script
+//
+// Independently of the budget, Lua never takes internal RAM that would
+// leave less than LUA_ALLOC_HEAP_RESERVE free, so the web UI and network
+// stacks can always serve a request while a script runs.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+// Largest request served from the slab pools
+#define LUA_ALLOC_MAX_SMALL 256
+
+// Memory limit for scripts in bytes, from "Lua memory limit" in menuconfig.
+// 0 uses LUA_ALLOC_BUDGET_PERCENT of the heap that is free when the first
+// VM is created. A script can change its own limit with set_mem_limit().
+#ifndef LUA_ALLOC_BUDGET
+#define LUA_ALLOC_BUDGET ((size_t)CONFIG_LUAMATRIX_LUA_MEM_LIMIT_KB * 1024)
+#endif
+
+#ifndef LUA_ALLOC_BUDGET_PERCENT
+#define LUA_ALLOC_BUDGET_PERCENT 50
+#endif
+
+#ifndef LUA_ALLOC_HEAP_RESERVE
+#define LUA_ALLOC_HEAP_RESERVE (48 * 1024)
+#endif
+
+#ifndef LUA_ALLOC_MINOR_GC_PERCENT
+#define LUA_ALLOC_MINOR_GC_PERCENT 75
+#endif
+
+#ifndef LUA_ALLOC_FULL_GC_PERCENT
+#define LUA_ALLOC_FULL_GC_PERCENT 90
+#endif
+
+struct lua_State;
+
+typedef struct {
+    size_t budget;          // hard limit for in_use, 0 = none
+    size_t in_use;          // bytes currently held by Lua
+    size_t peak;            // highest in_use since the last reset
+    size_t slab_bytes;      // memory held by slab pools, headers included
+    size_t slab_used;       // bytes of slab blocks handed out
+    size_t large_bytes;     // bytes in blocks above LUA_ALLOC_MAX_SMALL
+    size_t psram_bytes;     // part of large_bytes placed in PSRAM
+    uint32_t slabs;         // slabs currently allocated
+    uint32_t allocs;        // new blocks since the last reset
+    uint32_t frees;
+    uint32_t reallocs;      // resizes of existing blocks
+    uint32_t failures;      // requests refused (budget or heap exhausted)
+    uint32_t limit_hits;    // part of failures caused by the budget
+    uint32_t reserve_hits;  // part of failures to keep LUA_ALLOC_HEAP_RESERVE
+    uint32_t minor_gcs;     // minor collections run for memory pressure
+    uint32_t gc_steps;      // incremental steps run instead while frame GC is on
+    uint32_t full_gcs;
+    uint32_t gc_max_us;     // longest of those pauses
+    uint32_t gc_total_us;
+    uint8_t fragmentation;  // percentage of slab memory not handed out
+    bool psram;             // large blocks are placed in PSRAM
+} lua_alloc_stats_t;
+
+// lua_newstate() with this allocator
+struct lua_State *lua_alloc_newstate(void);
+
+// Limit for the running script; 0 goes back to LUA_ALLOC_BUDGET. Called
+// with 0 at the start of each script.
+void lua_alloc_set_budget(size_t bytes);
+
+// Called from the debug hook after LUA_SIGNAL_GC: runs the collections the
+// current usage calls for and records how long they took
+void lua_alloc_relieve_pressure(struct lua_State *L);
+
+void lua_alloc_get_stats(lua_alloc_stats_t *stats);
+
+// Starts a new measurement window: peak drops to the current usage and the
+// counters restart. Called at the start of each script.
+void lua_alloc_reset_stats(void);
+
+// Returns empty slabs kept for reuse to the heap, e.g. after lua_close()
+void lua_alloc_trim(void);
+
+void lua_alloc_log_stats(const char *message);
+
+// set_mem_limit(kb) - changes the running script's limit, nil or 0 for the
+// default; returns the limit now in effect in KB
+int lua_set_mem_limit(struct lua_State *LUA);
+
+// mem_stats() - returns the stats above as a table for the running script
+int lua_mem_stats(struct lua_State *LUA);
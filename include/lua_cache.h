@@ -0,0 +1,17 @@
+#pragma once
+
+// Bytecode cache for scripts and modules. A successfully compiled chunk is
+// dumped to LUA_FILE_PATH/.luac/<name>c together with the size, mtime and
+// FNV-1a hash of its source; later loads of an unchanged source read the
+// bytecode back and skip the parser. Debug info is kept, so error messages
+// still carry file names and line numbers.
+
+struct lua_State;
+
+// Drop-in for luaL_loadfile(): pushes the compiled chunk or an error
+// message and returns the load status
+int lua_cache_loadfile(struct lua_State *L, const char *path);
+
+// Replaces the Lua file searcher in package.searchers so require() goes
+// through the cache as well
+void lua_cache_install_searcher(struct lua_State *L);
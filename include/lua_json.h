@@ -0,0 +1,26 @@
+#pragma once
+
+// JSON for scripts, as the global table `json`:
+//
+//   json.decode(str)        value, or nil and "message at byte N"
+//   json.encode(value)      string; raises on functions, cycles, NaN, ...
+//   json.get(str, path)     single value at path, e.g. "data.temp" or
+//                           "list[2].name" (1-based), or nil if missing
+//   json.null               stands for null in decoded data and encode()
+//
+// get() walks the text and skips everything off the path without creating
+// Lua values for it, so pulling a few fields out of a large payload costs
+// no garbage. It stops once the value is found and does not validate the
+// rest of the document. decode() and get() return nil for a nil input,
+// so http_fetch() and mqtt_receive() failures pass straight through.
+//
+// Empty tables encode as {}; tables with keys 1..n only as arrays.
+
+#ifndef JSON_MAX_DEPTH
+#define JSON_MAX_DEPTH 64
+#endif
+
+struct lua_State;
+
+// Creates the global json table; called from load_lua_funcs()
+void lua_json_register(struct lua_State *L);
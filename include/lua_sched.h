@@ -0,0 +1,59 @@
+#pragma once
+
+// Cooperative scheduler for Lua coroutines. Scripts start tasks with
+// spawn() and every(); sleep(), wait_mqtt() and present() suspend only the
+// calling task. The tasks run whenever the main chunk waits in one of
+// those functions, and after it returns until none are left.
+//
+// Sleeping tasks sit in a min-heap ordered by wake time. Each pass of the
+// scheduler resumes every ready task once, then blocks in a single
+// semaphore wait until the earliest wake time or until an event (an MQTT
+// message, a signal for the script) gives the semaphore.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <lua.h>
+
+#ifndef LUA_SCHED_MAX_TASKS
+#define LUA_SCHED_MAX_TASKS 32
+#endif
+
+// Creates the wake semaphore; called once from lua_init()
+void lua_sched_init(void);
+
+// Wakes the scheduler from any task so it looks for new events
+void lua_sched_notify(void);
+
+// True while the script has tasks besides its main chunk
+bool lua_sched_has_tasks(void);
+
+// Suspends the caller until esp_timer time wake_us, then continues with k
+// (NULL returns no results). A task yields to the others; the main chunk
+// runs them meanwhile; other coroutines simply block.
+int lua_sched_wait_until(lua_State *L, int64_t wake_us, lua_KContext ctx, lua_KFunction k);
+
+// Suspends the caller until the next lua_sched_notify() or until wake_us
+// (0 for no timeout), then continues with k, which checks whether what it
+// waits for has happened and waits again if not. The main chunk runs the
+// other tasks until ready(arg) is true or the time is up.
+int lua_sched_wait_event(lua_State *L, int64_t wake_us, bool (*ready)(void *arg), void *arg,
+                         lua_KContext ctx, lua_KFunction k);
+
+// Runs the spawned tasks until all have finished. Called in protected mode
+// after the main chunk, as errors in a task end the script.
+int lua_sched_run(lua_State *L);
+
+// Drops every task, e.g. when a script ends
+void lua_sched_reset(lua_State *L);
+
+// spawn(fn, ...) - runs fn(...) as a new task, returns its id
+int lua_spawn(lua_State *LUA);
+// sleep(ms) - suspends the calling task for ms milliseconds
+int lua_sleep(lua_State *LUA);
+// every(ms, fn) - calls fn every ms milliseconds in its own task, returns its id
+int lua_every(lua_State *LUA);
+// wait_mqtt([topic[, timeout_ms]]) - waits for a message on topic (MQTT
+// wildcards allowed, nil for any). Returns topic, message or nil on timeout.
+int lua_wait_mqtt(lua_State *LUA);
+// cancel(id) - stops a task started by spawn() or every()
+int lua_cancel(lua_State *LUA);
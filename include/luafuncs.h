@@ -8,4 +8,11 @@ void load_lua_funcs(struct lua_State *LUA);
 
 // C-callable text drawing function
 // size: 3, 5, 8, or 16 (font pixel height)
-void draw_text(const char *str, int x, int y, int r, int g, int b, int size);
\ No newline at end of file
+void draw_text(const char *str, int x, int y, int r, int g, int b, int size);
+
+// C-callable versions of the shape primitives exposed to Lua
+void draw_line(int x0, int y0, int x1, int y1, int r, int g, int b);
+void draw_circle(int cx, int cy, int radius, int r, int g, int b);
+void draw_filled_circle(int cx, int cy, int radius, int r, int g, int b);
+void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int r, int g, int b);
+void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int r, int g, int b);
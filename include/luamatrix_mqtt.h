@@ -33,5 +33,10 @@ esp_err_t mqtt_publish(const char *topic, const char *data, int qos, int retain)
 // For Lua - get pending messages from queue
 bool mqtt_get_pending_message(char *topic, size_t tlen, char *data, size_t dlen);
 
+// Takes the oldest queued message whose topic match() accepts, leaving
+// the others queued in order for mqtt_get_pending_message()
+bool mqtt_take_message(bool (*match)(const char *topic, void *arg), void *arg,
+                       char *topic, size_t tlen, char *data, size_t dlen);
+
 // Blocking wait for message (returns false if timeout or not connected)
 bool mqtt_wait_for_message(char *topic, size_t tlen, char *data, size_t dlen, uint32_t timeout_ms);
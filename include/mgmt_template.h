@@ -0,0 +1,36 @@
+#pragma once
+
+// Web UI pages with placeholders. tools/compile_template.py turns a
+// template into a table of static text runs, each followed by one value,
+// at build time; rendering is then a row of httpd_resp_send_chunk calls
+// with no scanning of the page.
+
+#include <stdint.h>
+#include "esp_http_server.h"
+
+typedef enum {
+    TEMPLATE_ESC_HTML,  // element text and quoted attribute values
+    TEMPLATE_ESC_JS,    // inside a quoted string in a <script> block
+    TEMPLATE_ESC_RAW,   // trusted markup, sent as-is
+} template_escape_t;
+
+// Segment without a value after its text (the last one of a page)
+#define TEMPLATE_NO_VALUE 0xFF
+
+typedef struct {
+    uint16_t offset;    // static text in template_t.text
+    uint16_t len;
+    uint8_t value;      // index into the values passed to template_send
+    uint8_t escape;     // template_escape_t
+} template_segment_t;
+
+typedef struct {
+    const char *text;
+    const template_segment_t *segments;
+    uint16_t num_segments;
+    uint8_t num_values;
+} template_t;
+
+// Sends the page as a chunked response. values[] is indexed by the
+// enum in the generated header; NULL entries render as empty.
+esp_err_t template_send(httpd_req_t *req, const template_t *tpl, const char *const *values);
@@ -0,0 +1,61 @@
+#pragma once
+
+// Incremental multipart/form-data parser. The request body is fed in
+// whatever pieces httpd_req_recv returns; delimiters and part headers may
+// be split anywhere. Part contents are passed to on_data as slices of the
+// fed buffer, so nothing is copied or held back except the bytes of a
+// possible delimiter at the end of a piece.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Longest boundary allowed by RFC 2046
+#define MULTIPART_BOUNDARY_MAX 70
+
+// Part header lines longer than this are cut; only Content-Disposition is
+// looked at
+#define MULTIPART_HEADER_MAX 256
+
+#define MULTIPART_NAME_MAX 32
+#define MULTIPART_FILENAME_MAX 128
+
+typedef struct {
+    char name[MULTIPART_NAME_MAX + 1];          // form field name
+    char filename[MULTIPART_FILENAME_MAX + 1];  // empty for plain fields
+} multipart_part_t;
+
+// Each callback returns false to stop parsing; multipart_feed then
+// returns MULTIPART_ABORTED. on_part_end is only called for parts whose
+// closing delimiter was seen.
+typedef struct {
+    bool (*on_part_begin)(void *ctx, const multipart_part_t *part);
+    bool (*on_data)(void *ctx, const char *data, size_t len);
+    bool (*on_part_end)(void *ctx);
+} multipart_callbacks_t;
+
+typedef enum {
+    MULTIPART_OK,       // more input expected
+    MULTIPART_DONE,     // closing delimiter seen, rest is ignored
+    MULTIPART_ERROR,    // malformed body
+    MULTIPART_ABORTED,  // a callback returned false
+} multipart_result_t;
+
+typedef struct {
+    const multipart_callbacks_t *cb;
+    void *ctx;
+    char delim[4 + MULTIPART_BOUNDARY_MAX + 1];  // "\r\n--" boundary
+    size_t delim_len;
+    size_t match;       // delimiter bytes matched so far
+    int state;
+    multipart_result_t result;
+    char line[MULTIPART_HEADER_MAX];
+    size_t line_len;
+    multipart_part_t part;
+} multipart_parser_t;
+
+// Takes the boundary from a Content-Type header value. Returns false if
+// there is none or it is too long.
+bool multipart_init(multipart_parser_t *p, const char *content_type,
+                    const multipart_callbacks_t *cb, void *ctx);
+
+multipart_result_t multipart_feed(multipart_parser_t *p, const char *data, size_t len);
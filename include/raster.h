@@ -0,0 +1,52 @@
+#pragma once
+
+// Span rasterizer for the shape primitives. Every shape is clipped to the
+// panel before anything is drawn and written straight into the display
+// canvas as horizontal (or, for steep lines, vertical) runs, so off-screen
+// geometry costs next to nothing. Output is pixel-identical to the
+// original per-pixel algorithms in luafuncs.c; host/raster_test.c checks.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Horizontal run from x0 to x1 inclusive, in either order
+void raster_hspan(int x0, int x1, int y, int r, int g, int b);
+
+// Bresenham line including both end points
+void raster_line(int x0, int y0, int x1, int y1, int r, int g, int b);
+
+// Midpoint circle outline and fill
+void raster_circle(int cx, int cy, int radius, int r, int g, int b);
+void raster_filled_circle(int cx, int cy, int radius, int r, int g, int b);
+
+// Scanline triangle fill with integer edge stepping
+void raster_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int r, int g, int b);
+
+// 1-bit glyph blit. rows holds h row masks of bytes_per_row (1, 2 or 4)
+// bytes each, bit 0 being the leftmost of w <= 32 columns. Lit pixels are
+// written as runs; unlit pixels are left alone.
+void raster_glyph(int x, int y, const void *rows, int bytes_per_row, int w, int h,
+                  int r, int g, int b);
+
+// Anti-aliasing. The *_aa primitives blend 4-bit coverage into the canvas;
+// the mode flag only tells callers which variant to use, and makes
+// raster_glyph_aa() threshold coverage when off.
+void raster_set_antialias(bool on);
+bool raster_antialias(void);
+
+// Wu line and circle
+void raster_line_aa(int x0, int y0, int x1, int y1, int r, int g, int b);
+void raster_circle_aa(int cx, int cy, int radius, int r, int g, int b);
+
+// 4-bit coverage glyph: h rows of stride bytes, two pixels per byte with
+// the low nibble leftmost
+void raster_glyph_aa(int x, int y, const uint8_t *data, int stride, int w, int h,
+                     int r, int g, int b);
+
+#ifdef __cplusplus
+}
+#endif
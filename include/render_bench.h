@@ -0,0 +1,8 @@
+#pragma once
+
+// Forward declaration to avoid pulling in lua.h everywhere
+struct lua_State;
+
+// render_bench() - times every drawing binding, both as a direct C call and
+// as a call from Lua, and returns the results as a JSON string
+int lua_render_bench(struct lua_State *LUA);
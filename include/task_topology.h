@@ -0,0 +1,44 @@
+#pragma once
+
+// Where each firmware task runs. Scripts and the display flush task own
+// one core; WiFi/lwIP, the web UI, MQTT and the HTTP worker share the
+// other, so network bursts don't take CPU time from rendering. Set in
+// menuconfig under "luaMatrix task topology".
+
+#include "sdkconfig.h"
+
+#define LUA_TASK_CORE CONFIG_LUAMATRIX_LUA_CORE
+#define LUA_TASK_PRIORITY CONFIG_LUAMATRIX_LUA_PRIORITY
+#define LUA_TASK_STACK CONFIG_LUAMATRIX_LUA_STACK
+
+#define FLUSH_TASK_CORE CONFIG_LUAMATRIX_LUA_CORE
+#define FLUSH_TASK_PRIORITY CONFIG_LUAMATRIX_FLUSH_PRIORITY
+#define FLUSH_TASK_STACK CONFIG_LUAMATRIX_FLUSH_STACK
+
+// Fixed: lwIP's tcpip task and the MQTT task are pinned by their own
+// sdkconfig choices (CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU0,
+// CONFIG_MQTT_USE_CORE_0), which a project menu can't set
+#define NET_TASK_CORE 0
+#if defined(CONFIG_LWIP_TCPIP_TASK_AFFINITY_CPU1) || defined(CONFIG_MQTT_USE_CORE_1)
+#error "lwIP and MQTT must stay on core 0 with the other network tasks"
+#endif
+#define HTTPD_TASK_PRIORITY CONFIG_LUAMATRIX_HTTPD_PRIORITY
+#define MQTT_TASK_PRIORITY CONFIG_LUAMATRIX_MQTT_PRIORITY
+#define MQTT_TASK_STACK CONFIG_LUAMATRIX_MQTT_STACK
+#define HTTP_WORKER_PRIORITY CONFIG_LUAMATRIX_HTTP_WORKER_PRIORITY
+#define HTTP_WORKER_STACK CONFIG_LUAMATRIX_HTTP_WORKER_STACK
+#define MEMWATCH_TASK_STACK CONFIG_LUAMATRIX_MEMWATCH_STACK
+
+#define STACK_REPORT_MS CONFIG_LUAMATRIX_STACK_REPORT_MS
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Logs the stack each task has never touched so far. Tasks that don't
+// exist (e.g. MQTT while it is disabled) are skipped.
+void task_topology_report_stacks(void);
+
+#ifdef __cplusplus
+}
+#endif
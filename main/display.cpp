@@ -1,14 +1,71 @@
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 #include "hub75.h"
+#include "display.h"
+#include "task_topology.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
 static const char* TAG = "display";
 
+// How often the flush task pushes the canvas to the panel outside frame mode
+#define DISPLAY_FLUSH_INTERVAL_MS 16
+
+// Dirty rectangles tracked per flush. Beyond this, rectangles get merged
+// into whichever one grows the least.
+#define DISPLAY_MAX_DIRTY 8
+
+// Rectangles are merged anyway if that adds no more than this many clean
+// pixels to the flush
+#define DISPLAY_DIRTY_MERGE_SLACK 64
+
 Hub75Driver *driver;
 
-extern "C" void display_init() {
+// All drawing goes to this RGB888 canvas (row-major, 3 bytes per pixel).
+// Only the dirty parts are pushed to the driver, which keeps the bit-plane
+// encoding cost proportional to what actually changed.
+static uint8_t *s_canvas;
+static int s_width;
+static int s_height;
+
+// Half-open rectangle [x0, x1) x [y0, y1)
+typedef struct {
+    int x0, y0, x1, y1;
+} dirty_rect_t;
+
+typedef struct {
+    dirty_rect_t rects[DISPLAY_MAX_DIRTY];
+    int count;
+} dirty_list_t;
+
+// s_dirty collects what changed since the last flush and is shared with
+// the flush task, so it is only touched inside s_dirty_lock
+static dirty_list_t s_dirty;
+static portMUX_TYPE s_dirty_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Serialises use of the driver between the flush task, present() and
+// driver restarts
+static SemaphoreHandle_t s_driver_lock;
+
+// Frame mode state - see display_begin_frame()
+static bool s_frame_mode = false;
+static int s_brightness = 128;
+static int64_t s_frame_period_us = 1000000 / DISPLAY_DEFAULT_FPS;
+static int64_t s_next_frame_us = 0;
+
+// Frame mode fell back to the single-buffered driver: present() pushes the
+// frame without a buffer flip, so the panel may show it partly drawn
+static bool s_frame_single = false;
+
+// In frame mode the driver's back buffer is two frames old, so present()
+// also pushes whatever changed in the previous frame
+static dirty_list_t s_prev_frame_dirty;
+
+static Hub75Config make_config(bool double_buffer) {
     // Configure for your panel
     Hub75Config config{};
 
@@ -27,9 +84,9 @@ extern "C" void display_init() {
     config.output_clock_speed = Hub75ClockSpeed::HZ_20M;
     config.min_refresh_rate = 24;
     config.latch_blanking = 1;
-    config.double_buffer = false;
+    config.double_buffer = double_buffer;
 
-    config.brightness = 128;
+    config.brightness = s_brightness;
 
     // Set GPIO pins
     config.pins.r1 = 25;
@@ -47,42 +104,316 @@ extern "C" void display_init() {
     config.pins.oe = 15;
     config.pins.clk = 16;
 
+    return config;
+}
+
+// Returns false if the driver could not start refreshing, e.g. when there
+// is not enough DMA memory for its buffers. The driver object is kept so
+// the other functions can still call into it.
+static bool start_driver(bool double_buffer) {
     // Create and start driver
-    driver = new Hub75Driver(config);
+    driver = new Hub75Driver(make_config(double_buffer));
 
     driver->clear();
 
-    driver->begin();  // Starts continuous refresh
+    if (!driver->begin()) {  // Starts continuous refresh
+        ESP_LOGE(TAG, "Failed to start the %s-buffered driver", double_buffer ? "double" : "single");
+        return false;
+    }
+    return true;
+}
+
+static void stop_driver() {
+    driver->end();
+    delete driver;
+    driver = nullptr;
+}
+
+static inline int rect_area(const dirty_rect_t *r) {
+    return (r->x1 - r->x0) * (r->y1 - r->y0);
+}
+
+static inline dirty_rect_t rect_union(const dirty_rect_t *a, const dirty_rect_t *b) {
+    dirty_rect_t u;
+    u.x0 = a->x0 < b->x0 ? a->x0 : b->x0;
+    u.y0 = a->y0 < b->y0 ? a->y0 : b->y0;
+    u.x1 = a->x1 > b->x1 ? a->x1 : b->x1;
+    u.y1 = a->y1 > b->y1 ? a->y1 : b->y1;
+    return u;
+}
+
+static void dirty_list_add(dirty_list_t *list, const dirty_rect_t *r) {
+    int best = -1;
+    int best_cost = 0;
+
+    for (int i = 0; i < list->count; i++) {
+        dirty_rect_t *d = &list->rects[i];
+        // Already covered - the common case for consecutive pixels
+        if (r->x0 >= d->x0 && r->x1 <= d->x1 && r->y0 >= d->y0 && r->y1 <= d->y1) {
+            return;
+        }
+        dirty_rect_t u = rect_union(d, r);
+        int cost = rect_area(&u) - rect_area(d) - rect_area(r);
+        if (best < 0 || cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
+    }
+
+    if (best >= 0 && (best_cost <= DISPLAY_DIRTY_MERGE_SLACK || list->count == DISPLAY_MAX_DIRTY)) {
+        list->rects[best] = rect_union(&list->rects[best], r);
+    } else {
+        list->rects[list->count++] = *r;
+    }
+}
+
+// Clips to the canvas; returns false if nothing is left
+static inline bool clip_rect(int *x, int *y, int *w, int *h) {
+    if (*x < 0) { *w += *x; *x = 0; }
+    if (*y < 0) { *h += *y; *y = 0; }
+    if (*x + *w > s_width) *w = s_width - *x;
+    if (*y + *h > s_height) *h = s_height - *y;
+    return *w > 0 && *h > 0;
+}
+
+static void mark_dirty(int x, int y, int w, int h) {
+    dirty_rect_t r = { x, y, x + w, y + h };
+    taskENTER_CRITICAL(&s_dirty_lock);
+    dirty_list_add(&s_dirty, &r);
+    taskEXIT_CRITICAL(&s_dirty_lock);
+}
+
+static void mark_all_dirty() {
+    taskENTER_CRITICAL(&s_dirty_lock);
+    s_dirty.rects[0] = dirty_rect_t{ 0, 0, s_width, s_height };
+    s_dirty.count = 1;
+    taskEXIT_CRITICAL(&s_dirty_lock);
+}
+
+static dirty_list_t take_dirty() {
+    taskENTER_CRITICAL(&s_dirty_lock);
+    dirty_list_t list = s_dirty;
+    s_dirty.count = 0;
+    taskEXIT_CRITICAL(&s_dirty_lock);
+    return list;
+}
+
+// Push one rectangle of the canvas to the driver. Full-width rectangles are
+// contiguous in the canvas and go in one call, anything else row by row.
+// Must hold s_driver_lock.
+static void push_rect(const dirty_rect_t *r) {
+    int w = r->x1 - r->x0;
+    int h = r->y1 - r->y0;
+    const uint8_t *src = s_canvas + ((size_t)r->y0 * s_width + r->x0) * 3;
+
+    if (w == s_width) {
+        driver->draw_pixels(r->x0, r->y0, w, h, src, Hub75PixelFormat::RGB888);
+        return;
+    }
+    for (int y = r->y0; y < r->y1; y++) {
+        driver->draw_pixels(r->x0, y, w, 1, src, Hub75PixelFormat::RGB888);
+        src += s_width * 3;
+    }
+}
+
+// Pixels written concurrently with a flush are harmless: writers mark a
+// rectangle dirty after changing it, so anything missed here is pushed by
+// the next flush.
+static void flush_dirty(const dirty_list_t *list) {
+    for (int i = 0; i < list->count; i++) {
+        push_rect(&list->rects[i]);
+    }
+}
+
+static void flush_task(void *arg) {
+    (void)arg;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(DISPLAY_FLUSH_INTERVAL_MS));
+        xSemaphoreTake(s_driver_lock, portMAX_DELAY);
+        // Frame mode flushes from display_present() instead
+        if (!s_frame_mode) {
+            dirty_list_t list = take_dirty();
+            flush_dirty(&list);
+        }
+        xSemaphoreGive(s_driver_lock);
+    }
+}
+
+extern "C" void display_init() {
+    // Keep booting without a panel, so the web UI can still be reached
+    if (!start_driver(false)) {
+        ESP_LOGE(TAG, "Panel is not refreshing, continuing without it");
+    }
+    s_width = driver->get_width();
+    s_height = driver->get_height();
+
+    s_canvas = (uint8_t *)calloc((size_t)s_width * s_height, 3);
+    if (s_canvas == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %dx%d canvas", s_width, s_height);
+        abort();
+    }
+
+    s_driver_lock = xSemaphoreCreateMutex();
+    xTaskCreatePinnedToCore(flush_task, "display_flush", FLUSH_TASK_STACK, NULL,
+                            FLUSH_TASK_PRIORITY, NULL, FLUSH_TASK_CORE);
+}
+
+// The second frame buffer costs as much DMA memory as the first, so the
+// driver only runs double-buffered while a script is using frames.
+// Restarting it blanks the panel once, which begin_frame() does anyway.
+// Without memory for the second buffer frames are drawn single-buffered.
+extern "C" bool display_begin_frame() {
+    if (!s_frame_mode) {
+        ESP_LOGI(TAG, "Switching to double-buffered frame mode");
+        xSemaphoreTake(s_driver_lock, portMAX_DELAY);
+        stop_driver();
+        s_frame_single = !start_driver(true);
+        if (s_frame_single) {
+            ESP_LOGW(TAG, "Drawing frames single-buffered instead");
+            stop_driver();
+            start_driver(false);
+        }
+        s_frame_mode = true;
+        xSemaphoreGive(s_driver_lock);
+
+        // Both driver buffers start out black - so does the canvas
+        memset(s_canvas, 0, (size_t)s_width * s_height * 3);
+        take_dirty();
+        s_prev_frame_dirty.count = 0;
+        s_next_frame_us = esp_timer_get_time();
+        return !s_frame_single;
+    }
+
+    // Everything outside the last frame's dirty rectangles is still black,
+    // so clearing those is enough
+    for (int i = 0; i < s_prev_frame_dirty.count; i++) {
+        const dirty_rect_t *r = &s_prev_frame_dirty.rects[i];
+        size_t row_bytes = (size_t)(r->x1 - r->x0) * 3;
+        for (int y = r->y0; y < r->y1; y++) {
+            memset(s_canvas + ((size_t)y * s_width + r->x0) * 3, 0, row_bytes);
+        }
+        mark_dirty(r->x0, r->y0, r->x1 - r->x0, r->y1 - r->y0);
+    }
+    return !s_frame_single;
+}
+
+extern "C" void display_present() {
+    if (!s_frame_mode) {
+        return;
+    }
+
+    // Pace to the target frame rate. Deadlines advance by a fixed period so
+    // the rate doesn't drift; if we fell more than a frame behind, start over.
+    if (s_frame_period_us > 0) {
+        s_next_frame_us += s_frame_period_us;
+        int64_t now = esp_timer_get_time();
+        int64_t wait_us = s_next_frame_us - now;
+        if (wait_us < -s_frame_period_us) {
+            s_next_frame_us = now;
+        } else if (wait_us >= portTICK_PERIOD_MS * 1000) {
+            vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+        }
+    }
+
+    dirty_list_t list = take_dirty();
+    xSemaphoreTake(s_driver_lock, portMAX_DELAY);
+    flush_dirty(&s_prev_frame_dirty);
+    flush_dirty(&list);
+    // The driver picks up the new buffer at the end of the current refresh,
+    // so the panel never shows a partly drawn frame
+    if (!s_frame_single) {
+        driver->flip_buffer();
+    }
+    xSemaphoreGive(s_driver_lock);
+    s_prev_frame_dirty = list;
+}
+
+extern "C" void display_set_target_fps(int fps) {
+    s_frame_period_us = (fps > 0) ? 1000000 / fps : 0;
+}
+
+extern "C" int64_t display_frame_deadline() {
+    if (!s_frame_mode || s_frame_period_us <= 0) {
+        return 0;
+    }
+    return s_next_frame_us + s_frame_period_us;
+}
+
+extern "C" void display_end_frames() {
+    if (s_frame_mode) {
+        ESP_LOGI(TAG, "Leaving frame mode");
+        xSemaphoreTake(s_driver_lock, portMAX_DELAY);
+        stop_driver();
+        start_driver(false);
+        s_frame_mode = false;
+        s_frame_single = false;
+        xSemaphoreGive(s_driver_lock);
+        // The restarted driver is blank, the canvas may not be
+        mark_all_dirty();
+    }
+    s_frame_period_us = 1000000 / DISPLAY_DEFAULT_FPS;
+}
+
+extern "C" uint8_t *display_canvas(void) {
+    return s_canvas;
+}
+
+// Expects a rectangle already clipped to the canvas
+extern "C" void display_mark_dirty(int x, int y, int w, int h) {
+    mark_dirty(x, y, w, h);
 }
 
 extern "C" void clear_display() {
-    driver->clear();
+    memset(s_canvas, 0, (size_t)s_width * s_height * 3);
+    mark_all_dirty();
 }
 
 extern "C" void set_pixel(int x, int y, int r, int g, int b) {
-    driver->set_pixel(x, y, r, g, b);
+    if (x < 0 || y < 0 || x >= s_width || y >= s_height) return;
+    uint8_t *p = s_canvas + ((size_t)y * s_width + x) * 3;
+    p[0] = r;
+    p[1] = g;
+    p[2] = b;
+    mark_dirty(x, y, 1, 1);
 }
 
-extern "C" void vert_line(int x, int y, int len, int r, int g, int b) {
-    driver->fill(x,y,1,len,r,g,b);
+extern "C" void fill_rect(int x, int y, int w, int h, int r, int g, int b) {
+    if (!clip_rect(&x, &y, &w, &h)) return;
+
+    // Build the first row, then copy it down
+    uint8_t *first = s_canvas + ((size_t)y * s_width + x) * 3;
+    for (int col = 0; col < w; col++) {
+        first[col * 3] = r;
+        first[col * 3 + 1] = g;
+        first[col * 3 + 2] = b;
+    }
+    uint8_t *row = first;
+    for (int i = 1; i < h; i++) {
+        row += s_width * 3;
+        memcpy(row, first, (size_t)w * 3);
+    }
+    mark_dirty(x, y, w, h);
 }
 
-extern "C" void horiz_line(int x, int y, int len, int r, int g, int b) {
-    driver->fill(x,y,len,1,r,g,b);
+extern "C" void vert_line(int x, int y, int len, int r, int g, int b) {
+    fill_rect(x, y, 1, len, r, g, b);
 }
 
-extern "C" void fill_rect(int x, int y, int w, int h, int r, int g, int b) {
-    driver->fill(x, y, w, h, r, g, b);
+extern "C" void horiz_line(int x, int y, int len, int r, int g, int b) {
+    fill_rect(x, y, len, 1, r, g, b);
 }
 
 extern "C" void set_brightness(int b) {
+    s_brightness = b;
+    xSemaphoreTake(s_driver_lock, portMAX_DELAY);
     driver->set_brightness(b);
+    xSemaphoreGive(s_driver_lock);
 }
 
 extern "C" int get_width(void) {
-    return driver->get_width();
+    return s_width;
 }
 
 extern "C" int get_height(void) {
-    return driver->get_height();
-}
\ No newline at end of file
+    return s_height;
+}
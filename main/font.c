@@ -0,0 +1,449 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "display.h"
+#include "font.h"
+#include "local_lua.h"
+#include "raster.h"
+
+static const char* TAG = "font";
+
+#define FONT_MAGIC "LMF1"
+#define FONT_HEADER_SIZE 16
+#define FONT_RANGE_SIZE 12
+#define FONT_GLYPH_SIZE 8
+#define FONT_MAX_HEIGHT 32
+#define FONT_MAX_WIDTH 32
+#define FONT_MAX_RANGES 1024
+#define FONT_MAX_OPEN 4
+#define FONT_NO_GLYPH UINT32_MAX
+#define FONT_FLAG_COVERAGE 0x01
+
+// Glyph cache geometry. Slots grow their bitmap buffer to the largest
+// glyph they have held, so the cache costs a few KB for small fonts. It is
+// only allocated once a script actually uses a font.
+#define FONT_CACHE_SLOTS 64
+#define FONT_CACHE_BUCKETS 32
+#define FONT_CACHE_NONE -1
+
+typedef struct {
+    uint32_t first;
+    uint32_t count;
+    uint32_t first_glyph;
+} font_range_t;
+
+struct font {
+    char name[32];
+    FILE *fp;
+    uint8_t height;
+    bool coverage;          // 4-bit coverage bitmaps instead of 1-bit
+    uint16_t range_count;
+    uint32_t glyph_count;
+    uint32_t fallback;
+    uint32_t last_used;
+    font_range_t *ranges;
+};
+
+typedef struct {
+    const font_t *font;     // NULL while the slot is unused
+    uint32_t glyph;
+    uint8_t width;
+    uint8_t advance;
+    uint8_t top;
+    uint8_t rows;
+    int16_t lru_prev;
+    int16_t lru_next;
+    int16_t hash_next;
+    uint16_t capacity;
+    // One uint32_t mask per row for 1-bit fonts, the packed nibble rows
+    // from the file for coverage fonts
+    void *data;
+} glyph_slot_t;
+
+typedef struct {
+    glyph_slot_t slots[FONT_CACHE_SLOTS];
+    int16_t buckets[FONT_CACHE_BUCKETS];
+    int16_t lru_head;       // most recently used
+    int16_t lru_tail;       // next to be evicted
+} glyph_cache_t;
+
+static font_t s_fonts[FONT_MAX_OPEN];
+static uint32_t s_use_counter;
+static glyph_cache_t *s_cache;
+
+static uint32_t read_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint16_t read_u16(const uint8_t *p) {
+    return p[0] | (p[1] << 8);
+}
+
+// ============================================================================
+// Glyph cache
+// ============================================================================
+
+static int bucket_of(const font_t *font, uint32_t glyph) {
+    uint32_t h = (glyph * 2654435761u) ^ (uint32_t)(uintptr_t)font;
+    return (h >> 16) & (FONT_CACHE_BUCKETS - 1);
+}
+
+static void lru_unlink(int i) {
+    glyph_slot_t *s = &s_cache->slots[i];
+    if (s->lru_prev != FONT_CACHE_NONE) s_cache->slots[s->lru_prev].lru_next = s->lru_next;
+    else s_cache->lru_head = s->lru_next;
+    if (s->lru_next != FONT_CACHE_NONE) s_cache->slots[s->lru_next].lru_prev = s->lru_prev;
+    else s_cache->lru_tail = s->lru_prev;
+}
+
+static void lru_push_front(int i) {
+    glyph_slot_t *s = &s_cache->slots[i];
+    s->lru_prev = FONT_CACHE_NONE;
+    s->lru_next = s_cache->lru_head;
+    if (s_cache->lru_head != FONT_CACHE_NONE) s_cache->slots[s_cache->lru_head].lru_prev = i;
+    s_cache->lru_head = i;
+    if (s_cache->lru_tail == FONT_CACHE_NONE) s_cache->lru_tail = i;
+}
+
+static void hash_remove(int i) {
+    glyph_slot_t *s = &s_cache->slots[i];
+    int16_t *link = &s_cache->buckets[bucket_of(s->font, s->glyph)];
+    while (*link != FONT_CACHE_NONE) {
+        if (*link == i) {
+            *link = s->hash_next;
+            return;
+        }
+        link = &s_cache->slots[*link].hash_next;
+    }
+}
+
+static bool cache_init(void) {
+    if (s_cache) return true;
+    s_cache = malloc(sizeof(glyph_cache_t));
+    if (s_cache == NULL) {
+        ESP_LOGE(TAG, "No memory for the glyph cache");
+        return false;
+    }
+    for (int i = 0; i < FONT_CACHE_BUCKETS; i++) {
+        s_cache->buckets[i] = FONT_CACHE_NONE;
+    }
+    s_cache->lru_head = FONT_CACHE_NONE;
+    s_cache->lru_tail = FONT_CACHE_NONE;
+    for (int i = 0; i < FONT_CACHE_SLOTS; i++) {
+        s_cache->slots[i].font = NULL;
+        s_cache->slots[i].hash_next = FONT_CACHE_NONE;
+        s_cache->slots[i].capacity = 0;
+        s_cache->slots[i].data = NULL;
+        lru_push_front(i);
+    }
+    return true;
+}
+
+// Drops every cached glyph belonging to font
+static void cache_forget(const font_t *font) {
+    if (s_cache == NULL) return;
+    for (int i = 0; i < FONT_CACHE_SLOTS; i++) {
+        if (s_cache->slots[i].font == font) {
+            hash_remove(i);
+            s_cache->slots[i].font = NULL;
+            lru_unlink(i);
+            // Free slots go to the back so they are reused first
+            glyph_slot_t *s = &s_cache->slots[i];
+            s->lru_next = FONT_CACHE_NONE;
+            s->lru_prev = s_cache->lru_tail;
+            if (s_cache->lru_tail != FONT_CACHE_NONE) s_cache->slots[s_cache->lru_tail].lru_next = i;
+            s_cache->lru_tail = i;
+            if (s_cache->lru_head == FONT_CACHE_NONE) s_cache->lru_head = i;
+        }
+    }
+}
+
+// Reads metrics and bitmap of one glyph from the font file
+static bool load_glyph(const font_t *font, uint32_t glyph, glyph_slot_t *slot) {
+    uint8_t entry[FONT_GLYPH_SIZE];
+    long table = FONT_HEADER_SIZE + (long)font->range_count * FONT_RANGE_SIZE;
+
+    if (fseek(font->fp, table + (long)glyph * FONT_GLYPH_SIZE, SEEK_SET) != 0 ||
+        fread(entry, 1, sizeof(entry), font->fp) != sizeof(entry)) {
+        return false;
+    }
+    uint32_t offset = read_u32(entry);
+    slot->width = entry[4];
+    slot->advance = entry[5];
+    slot->top = entry[6];
+    slot->rows = entry[7];
+    if (slot->width > FONT_MAX_WIDTH || slot->top + slot->rows > font->height) {
+        return false;
+    }
+
+    int row_bytes = font->coverage ? (slot->width + 1) / 2 : (slot->width + 7) / 8;
+    int len = row_bytes * slot->rows;
+    int needed = font->coverage ? len : slot->rows * (int)sizeof(uint32_t);
+    if (needed > slot->capacity) {
+        void *data = realloc(slot->data, needed);
+        if (data == NULL) return false;
+        slot->data = data;
+        slot->capacity = needed;
+    }
+    if (len == 0) return true;
+
+    if (font->coverage) {
+        return fseek(font->fp, offset, SEEK_SET) == 0 &&
+               fread(slot->data, 1, len, font->fp) == (size_t)len;
+    }
+
+    uint8_t buf[FONT_MAX_HEIGHT * FONT_MAX_WIDTH / 8];
+    if (fseek(font->fp, offset, SEEK_SET) != 0 || fread(buf, 1, len, font->fp) != (size_t)len) {
+        return false;
+    }
+    uint32_t *rows = slot->data;
+    for (int row = 0; row < slot->rows; row++) {
+        uint32_t bits = 0;
+        for (int i = 0; i < row_bytes; i++) {
+            bits |= (uint32_t)buf[row * row_bytes + i] << (8 * i);
+        }
+        rows[row] = bits;
+    }
+    return true;
+}
+
+// Returns the cached glyph, reading it in over the least recently used slot
+// on a miss. The pointer is only valid until the next lookup.
+static const glyph_slot_t *glyph_lookup(font_t *font, uint32_t glyph) {
+    int bucket = bucket_of(font, glyph);
+    for (int i = s_cache->buckets[bucket]; i != FONT_CACHE_NONE; i = s_cache->slots[i].hash_next) {
+        glyph_slot_t *s = &s_cache->slots[i];
+        if (s->font == font && s->glyph == glyph) {
+            if (s_cache->lru_head != i) {
+                lru_unlink(i);
+                lru_push_front(i);
+            }
+            return s;
+        }
+    }
+
+    int i = s_cache->lru_tail;
+    glyph_slot_t *s = &s_cache->slots[i];
+    if (s->font != NULL) hash_remove(i);
+
+    if (!load_glyph(font, glyph, s)) {
+        ESP_LOGW(TAG, "%s: glyph %u is unreadable", font->name, (unsigned)glyph);
+        s->width = 0;
+        s->advance = 0;
+        s->rows = 0;
+    }
+    s->font = font;
+    s->glyph = glyph;
+    s->hash_next = s_cache->buckets[bucket];
+    s_cache->buckets[bucket] = i;
+    lru_unlink(i);
+    lru_push_front(i);
+    return s;
+}
+
+// ============================================================================
+// Fonts
+// ============================================================================
+
+static void font_close(font_t *font) {
+    cache_forget(font);
+    fclose(font->fp);
+    free(font->ranges);
+    memset(font, 0, sizeof(*font));
+}
+
+static bool font_open(font_t *font, const char *name) {
+    char path[128];
+    snprintf(path, sizeof(path), LUA_FILE_PATH "/%s", name);
+
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) {
+        ESP_LOGE(TAG, "Can't open font %s", path);
+        return false;
+    }
+
+    uint8_t header[FONT_HEADER_SIZE];
+    if (fread(header, 1, sizeof(header), fp) != sizeof(header) ||
+        memcmp(header, FONT_MAGIC, 4) != 0) {
+        ESP_LOGE(TAG, "%s is not a font file", path);
+        fclose(fp);
+        return false;
+    }
+
+    uint8_t height = header[4];
+    uint8_t flags = header[5];
+    uint16_t range_count = read_u16(header + 6);
+    uint32_t glyph_count = read_u32(header + 8);
+    uint32_t fallback = read_u32(header + 12);
+    if (height == 0 || height > FONT_MAX_HEIGHT || range_count > FONT_MAX_RANGES) {
+        ESP_LOGE(TAG, "%s: unsupported height %d or %d ranges", path, height, range_count);
+        fclose(fp);
+        return false;
+    }
+
+    font_range_t *ranges = calloc(range_count ? range_count : 1, sizeof(font_range_t));
+    if (ranges == NULL) {
+        ESP_LOGE(TAG, "%s: no memory for %d ranges", path, range_count);
+        fclose(fp);
+        return false;
+    }
+    for (int i = 0; i < range_count; i++) {
+        uint8_t entry[FONT_RANGE_SIZE];
+        if (fread(entry, 1, sizeof(entry), fp) != sizeof(entry)) {
+            ESP_LOGE(TAG, "%s: truncated range table", path);
+            free(ranges);
+            fclose(fp);
+            return false;
+        }
+        ranges[i].first = read_u32(entry);
+        ranges[i].count = read_u16(entry + 4);
+        ranges[i].first_glyph = read_u32(entry + 8);
+        if (ranges[i].first_glyph + ranges[i].count > glyph_count) {
+            ESP_LOGE(TAG, "%s: range %d points past the glyph table", path, i);
+            free(ranges);
+            fclose(fp);
+            return false;
+        }
+    }
+
+    strncpy(font->name, name, sizeof(font->name) - 1);
+    font->fp = fp;
+    font->height = height;
+    font->coverage = flags & FONT_FLAG_COVERAGE;
+    font->range_count = range_count;
+    font->glyph_count = glyph_count;
+    font->fallback = fallback < glyph_count ? fallback : FONT_NO_GLYPH;
+    font->ranges = ranges;
+    ESP_LOGI(TAG, "Loaded %s: %d px, %u glyphs in %d ranges", name, height,
+             (unsigned)glyph_count, range_count);
+    return true;
+}
+
+font_t *font_get(const char *name) {
+    if (strlen(name) >= sizeof(s_fonts[0].name)) {
+        ESP_LOGE(TAG, "Font name too long: %s", name);
+        return NULL;
+    }
+    if (!cache_init()) return NULL;
+
+    font_t *victim = &s_fonts[0];
+    for (int i = 0; i < FONT_MAX_OPEN; i++) {
+        font_t *font = &s_fonts[i];
+        if (font->fp != NULL && strcmp(font->name, name) == 0) {
+            font->last_used = ++s_use_counter;
+            return font;
+        }
+        // Prefer an empty entry, otherwise the least recently used font
+        if (victim->fp != NULL && (font->fp == NULL || font->last_used < victim->last_used)) {
+            victim = font;
+        }
+    }
+
+    if (victim->fp != NULL) font_close(victim);
+    if (!font_open(victim, name)) return NULL;
+    victim->last_used = ++s_use_counter;
+    return victim;
+}
+
+int font_height(const font_t *font) {
+    return font->height;
+}
+
+void font_close_all(void) {
+    for (int i = 0; i < FONT_MAX_OPEN; i++) {
+        if (s_fonts[i].fp != NULL) font_close(&s_fonts[i]);
+    }
+    if (s_cache) {
+        for (int i = 0; i < FONT_CACHE_SLOTS; i++) {
+            free(s_cache->slots[i].data);
+        }
+        free(s_cache);
+        s_cache = NULL;
+    }
+}
+
+// Next codepoint of a UTF-8 string. Malformed sequences decode as U+FFFD
+// one byte at a time.
+static uint32_t utf8_next(const char **str) {
+    const uint8_t *s = (const uint8_t *)*str;
+    uint32_t cp;
+    int extra;
+
+    if (s[0] < 0x80) {
+        *str += 1;
+        return s[0];
+    } else if ((s[0] & 0xE0) == 0xC0) {
+        cp = s[0] & 0x1F;
+        extra = 1;
+    } else if ((s[0] & 0xF0) == 0xE0) {
+        cp = s[0] & 0x0F;
+        extra = 2;
+    } else if ((s[0] & 0xF8) == 0xF0) {
+        cp = s[0] & 0x07;
+        extra = 3;
+    } else {
+        *str += 1;
+        return 0xFFFD;
+    }
+
+    for (int i = 1; i <= extra; i++) {
+        if ((s[i] & 0xC0) != 0x80) {
+            *str += 1;
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (s[i] & 0x3F);
+    }
+    *str += 1 + extra;
+    return cp;
+}
+
+// Glyph index for a codepoint, or the font's fallback glyph
+static uint32_t glyph_index(const font_t *font, uint32_t cp) {
+    int lo = 0, hi = font->range_count - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        const font_range_t *range = &font->ranges[mid];
+        if (cp < range->first) {
+            hi = mid - 1;
+        } else if (cp - range->first >= range->count) {
+            lo = mid + 1;
+        } else {
+            return range->first_glyph + (cp - range->first);
+        }
+    }
+    return font->fallback;
+}
+
+void font_draw_string(font_t *font, const char *str, int x, int y, int r, int g, int b) {
+    int width = get_width();
+    if (y >= get_height() || y + font->height <= 0) return;
+
+    while (*str && x < width) {
+        uint32_t glyph = glyph_index(font, utf8_next(&str));
+        if (glyph == FONT_NO_GLYPH) continue;
+
+        const glyph_slot_t *slot = glyph_lookup(font, glyph);
+        if (slot->rows > 0 && x + slot->width > 0) {
+            if (font->coverage) {
+                raster_glyph_aa(x, y + slot->top, slot->data, (slot->width + 1) / 2,
+                                slot->width, slot->rows, r, g, b);
+            } else {
+                raster_glyph(x, y + slot->top, slot->data, 4, slot->width, slot->rows, r, g, b);
+            }
+        }
+        x += slot->advance;
+    }
+}
+
+int font_text_width(font_t *font, const char *str) {
+    int width = 0;
+    while (*str) {
+        uint32_t glyph = glyph_index(font, utf8_next(&str));
+        if (glyph == FONT_NO_GLYPH) continue;
+        width += glyph_lookup(font, glyph)->advance;
+    }
+    return width;
+}
@@ -0,0 +1,134 @@
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "display.h"
+#include "frame_gc.h"
+
+static const char* TAG = "frame_gc";
+
+// Left free before the deadline so present() shows the frame on time
+#define FRAME_GC_MARGIN_US 300
+
+// Starting guess for the cost of one collector step
+#define FRAME_GC_STEP_US 100
+
+typedef struct {
+    uint32_t frames;        // paced frames presented
+    uint32_t missed;        // frames that reached present() after their deadline
+    uint32_t gc_us;         // collector time in the last frame's slack
+    uint32_t gc_max_us;
+    uint64_t gc_total_us;
+    uint32_t slack_us;      // idle time the last frame had left after collecting
+    uint32_t steps;
+    uint32_t cycles;        // collection cycles finished in the slack
+} frame_stats_t;
+
+static frame_stats_t s_stats;
+static bool s_enabled = true;
+static bool s_incremental = false;
+static uint32_t s_step_us = FRAME_GC_STEP_US;
+
+void frame_gc_begin(lua_State *L) {
+    if (!s_enabled || s_incremental) {
+        return;
+    }
+    // Incremental steps are small and can be stopped at any point, unlike
+    // the generational collector's minor and major collections
+    lua_gc(L, LUA_GCINC, 0, 0, 0);
+    s_incremental = true;
+    ESP_LOGI(TAG, "Collecting in frame slack");
+}
+
+void frame_gc_run(lua_State *L) {
+    if (!s_incremental) {
+        return;
+    }
+    int64_t deadline = display_frame_deadline();
+    if (deadline == 0) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    s_stats.frames++;
+    s_stats.gc_us = 0;
+    s_stats.slack_us = 0;
+    if (start >= deadline) {
+        s_stats.missed++;
+        return;
+    }
+
+    // collectgarbage("stop") in the script wins
+    int64_t now = start;
+    int64_t stop_at = deadline - FRAME_GC_MARGIN_US;
+    while (now + s_step_us < stop_at && lua_gc(L, LUA_GCISRUNNING)) {
+        int cycle_done = lua_gc(L, LUA_GCSTEP, 0);
+        int64_t after = esp_timer_get_time();
+        uint32_t took = (uint32_t)(after - now);
+        now = after;
+
+        // Follow the slowest recent step, decaying so a single slow one
+        // does not keep the loop from running for long
+        s_step_us = took > s_step_us ? took : (s_step_us * 7 + took) / 8;
+        s_stats.steps++;
+
+        // Nothing left to collect until the script allocates some more
+        if (cycle_done) {
+            s_stats.cycles++;
+            break;
+        }
+    }
+
+    s_stats.gc_us = (uint32_t)(now - start);
+    s_stats.gc_total_us += s_stats.gc_us;
+    if (s_stats.gc_us > s_stats.gc_max_us) {
+        s_stats.gc_max_us = s_stats.gc_us;
+    }
+    s_stats.slack_us = now < deadline ? (uint32_t)(deadline - now) : 0;
+}
+
+bool frame_gc_incremental(void) {
+    return s_incremental;
+}
+
+void frame_gc_reset(void) {
+    if (s_stats.frames > 0) {
+        ESP_LOGI(TAG, "%u frames, %u late, GC avg %u us max %u us per frame, %u steps, %u cycles",
+            (unsigned)s_stats.frames, (unsigned)s_stats.missed,
+            (unsigned)(s_stats.gc_total_us / s_stats.frames), (unsigned)s_stats.gc_max_us,
+            (unsigned)s_stats.steps, (unsigned)s_stats.cycles);
+    }
+    memset(&s_stats, 0, sizeof(s_stats));
+    s_enabled = true;
+    s_incremental = false;
+    s_step_us = FRAME_GC_STEP_US;
+}
+
+int lua_set_frame_gc(lua_State *LUA) {
+    s_enabled = lua_toboolean(LUA, 1);
+    if (!s_enabled && s_incremental) {
+        lua_gc(LUA, LUA_GCGEN, 0, 0);
+        s_incremental = false;
+    }
+    return 0;
+}
+
+#define SET_FIELD(name, value) \
+    do { lua_pushinteger(LUA, (lua_Integer)(value)); lua_setfield(LUA, -2, name); } while (0)
+
+int lua_frame_stats(lua_State *LUA) {
+    lua_createtable(LUA, 0, 8);
+    SET_FIELD("frames", s_stats.frames);
+    SET_FIELD("missed", s_stats.missed);
+    SET_FIELD("gc_us", s_stats.gc_us);
+    SET_FIELD("gc_max_us", s_stats.gc_max_us);
+    SET_FIELD("gc_avg_us", s_stats.frames ? s_stats.gc_total_us / s_stats.frames : 0);
+    SET_FIELD("slack_us", s_stats.slack_us);
+    SET_FIELD("steps", s_stats.steps);
+    SET_FIELD("cycles", s_stats.cycles);
+    return 1;
+}
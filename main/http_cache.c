@@ -0,0 +1,337 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "http_cache.h"
+
+static const char* TAG = "http_cache";
+
+#define CACHE_MAGIC "LHC1"
+
+// Wall clock times before this mean nobody has set the clock
+#define CLOCK_VALID_AFTER 1577836800  // 2020-01-01
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+typedef struct {
+    uint32_t key;           // FNV-1a of url, 0 = free slot
+    char *url;
+    http_cache_meta_t meta;
+    int64_t expires_us;     // esp_timer time
+    uint32_t last_used;
+    char *body;
+    int len;
+} ram_entry_t;
+
+// File header, followed by the url and the body
+typedef struct {
+    char magic[4];
+    uint32_t url_len;
+    uint32_t body_len;
+    int64_t expires;        // wall clock seconds, 0 = revalidate
+    char etag[64];
+    char last_modified[40];
+} disk_header_t;
+
+static SemaphoreHandle_t s_lock;
+static ram_entry_t s_ram[HTTP_CACHE_RAM_ENTRIES];
+static uint32_t s_use_counter;
+
+static uint32_t hash_url(const char *url) {
+    uint32_t h = FNV_OFFSET;
+    for (const char *p = url; *p; p++) {
+        h = (h ^ (uint8_t)*p) * FNV_PRIME;
+    }
+    return h ? h : 1;
+}
+
+static bool clock_valid(time_t now) {
+    return now > CLOCK_VALID_AFTER;
+}
+
+static void disk_path(uint32_t key, char *out, size_t len) {
+    snprintf(out, len, HTTP_CACHE_DIR "/%08lx", (unsigned long)key);
+}
+
+void http_cache_init(void) {
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+    }
+}
+
+void http_cache_meta_init(http_cache_meta_t *meta) {
+    memset(meta, 0, sizeof(*meta));
+    meta->max_age = -1;
+}
+
+void http_cache_on_header(http_cache_meta_t *meta, const char *key, const char *value) {
+    if (strcasecmp(key, "ETag") == 0) {
+        snprintf(meta->etag, sizeof(meta->etag), "%s", value);
+    } else if (strcasecmp(key, "Last-Modified") == 0) {
+        snprintf(meta->last_modified, sizeof(meta->last_modified), "%s", value);
+    } else if (strcasecmp(key, "Cache-Control") == 0) {
+        // Comma separated directives; only the ones that matter to a
+        // private cache are looked at
+        const char *p = value;
+        while (*p) {
+            while (*p == ' ' || *p == ',') p++;
+            if (strncasecmp(p, "max-age=", 8) == 0) {
+                meta->max_age = atoi(p + 8);
+            } else if (strncasecmp(p, "no-store", 8) == 0) {
+                meta->no_store = true;
+            } else if (strncasecmp(p, "no-cache", 8) == 0) {
+                meta->no_cache = true;
+            }
+            while (*p && *p != ',') p++;
+        }
+        // no-cache wins over a max-age in any order or header
+        if (meta->no_cache) {
+            meta->max_age = 0;
+        }
+    }
+}
+
+// ============================================================================
+// RAM LRU
+// ============================================================================
+
+static ram_entry_t *ram_find(uint32_t key, const char *url) {
+    for (int i = 0; i < HTTP_CACHE_RAM_ENTRIES; i++) {
+        if (s_ram[i].key == key && strcmp(s_ram[i].url, url) == 0) {
+            return &s_ram[i];
+        }
+    }
+    return NULL;
+}
+
+static void ram_clear(ram_entry_t *e) {
+    free(e->url);
+    free(e->body);
+    memset(e, 0, sizeof(*e));
+}
+
+static void ram_put(uint32_t key, const char *url, const http_cache_meta_t *meta,
+                    int64_t expires_us, const char *body, int len) {
+    ram_entry_t *e = ram_find(key, url);
+    if (e == NULL) {
+        // Free slot, or else the least recently used one
+        e = &s_ram[0];
+        for (int i = 0; i < HTTP_CACHE_RAM_ENTRIES && e->key != 0; i++) {
+            if (s_ram[i].key == 0 || s_ram[i].last_used < e->last_used) {
+                e = &s_ram[i];
+            }
+        }
+    }
+
+    char *url_copy = strdup(url);
+    char *body_copy = malloc(len + 1);
+    if (url_copy == NULL || body_copy == NULL) {
+        free(url_copy);
+        free(body_copy);
+        ram_clear(e);
+        return;
+    }
+    memcpy(body_copy, body, len);
+    body_copy[len] = '\0';
+
+    ram_clear(e);
+    e->key = key;
+    e->url = url_copy;
+    e->meta = *meta;
+    e->expires_us = expires_us;
+    e->last_used = ++s_use_counter;
+    e->body = body_copy;
+    e->len = len;
+}
+
+// ============================================================================
+// Flash store
+// ============================================================================
+
+static bool disk_read(uint32_t key, const char *url, disk_header_t *header, char **body) {
+    char path[64];
+    disk_path(key, path, sizeof(path));
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    size_t url_len = strlen(url);
+    bool ok = fread(header, sizeof(*header), 1, fp) == 1 &&
+              memcmp(header->magic, CACHE_MAGIC, sizeof(header->magic)) == 0 &&
+              header->url_len == url_len;
+
+    // The file name is only a hash, so the url inside has to match as well
+    char *buf = NULL;
+    if (ok) {
+        buf = malloc(url_len + header->body_len + 1);
+        ok = buf != NULL &&
+             fread(buf, 1, url_len + header->body_len, fp) == url_len + header->body_len &&
+             memcmp(buf, url, url_len) == 0;
+    }
+    fclose(fp);
+
+    if (!ok) {
+        free(buf);
+        return false;
+    }
+    memmove(buf, buf + url_len, header->body_len);
+    buf[header->body_len] = '\0';
+    header->etag[sizeof(header->etag) - 1] = '\0';
+    header->last_modified[sizeof(header->last_modified) - 1] = '\0';
+    *body = buf;
+    return true;
+}
+
+// Drops the oldest other entries until the directory plus incoming fits
+static void disk_make_room(const char *keep, size_t incoming) {
+    char path[300], oldest[300];
+    struct stat st;
+
+    while (true) {
+        DIR *dir = opendir(HTTP_CACHE_DIR);
+        if (dir == NULL) return;
+
+        size_t total = incoming;
+        time_t oldest_mtime = 0;
+        oldest[0] = '\0';
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            snprintf(path, sizeof(path), HTTP_CACHE_DIR "/%s", ent->d_name);
+            if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+            total += st.st_size;
+            if (strcmp(path, keep) != 0 && (oldest[0] == '\0' || st.st_mtime < oldest_mtime)) {
+                strcpy(oldest, path);
+                oldest_mtime = st.st_mtime;
+            }
+        }
+        closedir(dir);
+
+        if (total <= HTTP_CACHE_DISK_MAX || oldest[0] == '\0' || remove(oldest) != 0) {
+            return;
+        }
+        ESP_LOGD(TAG, "Dropped %s", oldest);
+    }
+}
+
+static void disk_write(uint32_t key, const char *url, const http_cache_meta_t *meta,
+                       time_t expires, const char *body, int len) {
+    char path[64], tmp[72];
+    disk_path(key, path, sizeof(path));
+
+    disk_header_t header = { 0 };
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.url_len = strlen(url);
+    header.body_len = len;
+    header.expires = expires;
+    memcpy(header.etag, meta->etag, sizeof(header.etag));
+    memcpy(header.last_modified, meta->last_modified, sizeof(header.last_modified));
+
+    size_t size = sizeof(header) + header.url_len + len;
+    if (size > HTTP_CACHE_DISK_MAX) {
+        remove(path);
+        return;
+    }
+    mkdir(HTTP_CACHE_DIR, 0755);
+    disk_make_room(path, size);
+
+    // Write under a temporary name so a reset never leaves half a file
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        ESP_LOGW(TAG, "Can't create %s", tmp);
+        return;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              fwrite(url, 1, header.url_len, fp) == header.url_len &&
+              fwrite(body, 1, len, fp) == (size_t)len;
+    ok = (fclose(fp) == 0) && ok;
+    if (ok) {
+        remove(path);
+        ok = rename(tmp, path) == 0;
+    }
+    if (!ok) {
+        ESP_LOGW(TAG, "Failed to write %s", path);
+        remove(tmp);
+    }
+}
+
+// ============================================================================
+// Public API
+// ============================================================================
+
+bool http_cache_lookup(const char *url, http_cache_entry_t *entry) {
+    uint32_t key = hash_url(url);
+    bool found = false;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    ram_entry_t *e = ram_find(key, url);
+    if (e != NULL) {
+        entry->body = malloc(e->len + 1);
+        if (entry->body != NULL) {
+            memcpy(entry->body, e->body, e->len + 1);
+            entry->len = e->len;
+            entry->meta = e->meta;
+            entry->fresh = esp_timer_get_time() < e->expires_us;
+            e->last_used = ++s_use_counter;
+            found = true;
+        }
+    } else {
+        disk_header_t header;
+        if (disk_read(key, url, &header, &entry->body)) {
+            time_t now = time(NULL);
+            http_cache_meta_init(&entry->meta);
+            memcpy(entry->meta.etag, header.etag, sizeof(header.etag));
+            memcpy(entry->meta.last_modified, header.last_modified, sizeof(header.last_modified));
+            entry->len = header.body_len;
+            entry->fresh = clock_valid(now) && now < header.expires;
+            if (entry->len <= HTTP_CACHE_RAM_MAX_BODY) {
+                int64_t remaining_us = entry->fresh ? (int64_t)(header.expires - now) * 1000000 : 0;
+                ram_put(key, url, &entry->meta, esp_timer_get_time() + remaining_us,
+                        entry->body, entry->len);
+            }
+            found = true;
+        }
+    }
+    xSemaphoreGive(s_lock);
+
+    ESP_LOGD(TAG, "%s: %s", url, found ? (entry->fresh ? "fresh" : "stale") : "not cached");
+    return found;
+}
+
+void http_cache_store(const char *url, const http_cache_meta_t *meta, const char *body, int len) {
+    uint32_t key = hash_url(url);
+    bool validators = meta->etag[0] || meta->last_modified[0];
+    if (meta->no_store || (meta->max_age <= 0 && !validators)) {
+        return;
+    }
+
+    int32_t max_age = meta->max_age > 0 ? meta->max_age : 0;
+    time_t now = time(NULL);
+    time_t expires = (max_age > 0 && clock_valid(now)) ? now + max_age : 0;
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    if (len <= HTTP_CACHE_RAM_MAX_BODY) {
+        ram_put(key, url, meta, esp_timer_get_time() + (int64_t)max_age * 1000000, body, len);
+    } else {
+        ram_entry_t *e = ram_find(key, url);
+        if (e != NULL) ram_clear(e);
+    }
+    disk_write(key, url, meta, expires, body, len);
+    xSemaphoreGive(s_lock);
+}
+
+const char *http_cache_status_name(http_cache_status_t status) {
+    switch (status) {
+        case HTTP_CACHE_MISS: return "miss";
+        case HTTP_CACHE_HIT: return "hit";
+        case HTTP_CACHE_REVALIDATED: return "revalidated";
+        default: return "bypass";
+    }
+}
@@ -0,0 +1,601 @@
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+#include "http_cache.h"
+#include "http_fetch.h"
+#include "http_pool.h"
+#include "local_lua.h"
+#include "lua_sched.h"
+#include "task_topology.h"
+
+static const char* TAG = "http_fetch";
+
+#define HTTP_FETCH_TIMEOUT_MS 10000
+#define HTTP_STREAM_CHUNK 2048
+
+#define FUTURE_META "luamatrix.http_future"
+
+typedef enum {
+    REQUEST_QUEUED,
+    REQUEST_RUNNING,
+    REQUEST_DONE,
+} request_state_t;
+
+// Shared by the Lua future and the worker. Each holds a reference; the
+// last one to let go frees it, so a future collected mid-request is safe.
+typedef struct {
+    atomic_int refs;
+    atomic_int state;
+    char url[512];
+    int timeout_ms;
+    int max_size;
+    bool use_cache;
+
+    // Valid once state is REQUEST_DONE
+    int status;           // HTTP status code, 0 without a response
+    http_cache_status_t cache;
+    char *body;           // malloc'd, moved into Lua by the first result()
+    int body_len;
+    char error[64];
+} http_request_t;
+
+static QueueHandle_t s_queue;
+
+static void request_release(http_request_t *req) {
+    if (atomic_fetch_sub(&req->refs, 1) == 1) {
+        free(req->body);
+        free(req);
+    }
+}
+
+static void build_url(char *url, size_t len, const char *arg) {
+    if (strncmp(arg, "http://", 7) == 0 || strncmp(arg, "https://", 8) == 0) {
+        snprintf(url, len, "%s", arg);
+    } else {
+        snprintf(url, len, "http://%s", arg);
+    }
+}
+
+// Per-request state for the event handler
+typedef struct {
+    http_cache_meta_t *meta;    // NULL when the cache is not involved
+    bool close;                 // server sent "Connection: close"
+} response_info_t;
+
+static esp_err_t on_http_event(esp_http_client_event_t *evt) {
+    response_info_t *info = evt->user_data;
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && info != NULL) {
+        if (strcasecmp(evt->header_key, "Connection") == 0 &&
+            strcasecmp(evt->header_value, "close") == 0) {
+            info->close = true;
+        }
+        if (info->meta != NULL) {
+            http_cache_on_header(info->meta, evt->header_key, evt->header_value);
+        }
+    }
+    return ESP_OK;
+}
+
+// Sends the request, conditionally if cached is given, and reads the
+// response headers. A pooled connection the server has dropped since its
+// last use is replaced by a new one, once.
+static esp_http_client_handle_t request_start(http_request_t *req, response_info_t *info,
+                                              const http_cache_entry_t *cached,
+                                              int *content_length) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused;
+        esp_http_client_handle_t client = http_pool_acquire(req->url, req->timeout_ms,
+                                                            on_http_event, info, &reused);
+        if (client == NULL) {
+            ESP_LOGE(TAG, "Failed to init HTTP client");
+            snprintf(req->error, sizeof(req->error), "HTTP client init failed");
+            return NULL;
+        }
+
+        // Headers stay set on a handle, so clear the last request's
+        esp_http_client_delete_header(client, "If-None-Match");
+        esp_http_client_delete_header(client, "If-Modified-Since");
+        if (cached != NULL) {
+            if (cached->meta.etag[0]) {
+                esp_http_client_set_header(client, "If-None-Match", cached->meta.etag);
+            }
+            if (cached->meta.last_modified[0]) {
+                esp_http_client_set_header(client, "If-Modified-Since", cached->meta.last_modified);
+            }
+        }
+
+        esp_err_t err = esp_http_client_open(client, 0);
+        if (err == ESP_OK) {
+            *content_length = esp_http_client_fetch_headers(client);
+            if (esp_http_client_get_status_code(client) > 0) {
+                return client;
+            }
+            err = ESP_FAIL;
+        }
+        http_pool_release(client, false);
+
+        if (!reused) {
+            ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
+            snprintf(req->error, sizeof(req->error), "connect failed: %s", esp_err_to_name(err));
+            return NULL;
+        }
+        ESP_LOGD(TAG, "Pooled connection for %s was dropped, reconnecting", req->url);
+        info->close = false;
+    }
+    return NULL;
+}
+
+// The connection can serve the next request if the response was read to
+// its end and the server didn't ask to close it
+static bool can_keep(esp_http_client_handle_t client, const response_info_t *info) {
+    return !info->close && esp_http_client_is_complete_data_received(client);
+}
+
+// Asks the server, conditionally if cached is given, and fills in the
+// results. A 304 leaves req->body NULL for the caller to fill in.
+static void request_network(http_request_t *req, const http_cache_entry_t *cached,
+                            http_cache_meta_t *meta) {
+    response_info_t info = { .meta = meta };
+    int header_length;
+    esp_http_client_handle_t client = request_start(req, &info, cached, &header_length);
+    if (client == NULL) {
+        return;
+    }
+
+    int status = esp_http_client_get_status_code(client);
+    if (status == 304) {
+        req->status = status;
+        http_pool_release(client, can_keep(client, &info));
+        return;
+    }
+
+    int content_length = header_length;
+    if (content_length < 0 || content_length > req->max_size) {
+        // Unknown length, or more than we keep: read up to the limit
+        content_length = req->max_size;
+    }
+
+    char *buffer = malloc(content_length + 1);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate buffer for HTTP response");
+        snprintf(req->error, sizeof(req->error), "out of memory");
+        http_pool_release(client, false);
+        return;
+    }
+
+    int total_read = 0;
+    while (total_read < content_length) {
+        int read_len = esp_http_client_read(client, buffer + total_read, content_length - total_read);
+        if (read_len <= 0) {
+            break;
+        }
+        total_read += read_len;
+    }
+    buffer[total_read] = '\0';
+
+    // A body cut off at max_size must not be cached as the whole response
+    if (header_length >= 0 ? total_read != header_length : total_read == content_length) {
+        ESP_LOGW(TAG, "%s: body truncated to %d bytes, see http_stream()", req->url, total_read);
+        meta->no_store = true;
+    }
+
+    http_pool_release(client, can_keep(client, &info));
+
+    req->status = status;
+    req->body = buffer;
+    req->body_len = total_read;
+}
+
+// Runs the request on the calling task and fills in the results. The
+// cache answers it when it can, otherwise the server is asked.
+static void request_perform(http_request_t *req) {
+    http_cache_entry_t cached = { 0 };
+    bool have = req->use_cache && http_cache_lookup(req->url, &cached);
+
+    if (have && cached.fresh) {
+        req->status = 200;
+        req->cache = HTTP_CACHE_HIT;
+    } else {
+        http_cache_meta_t meta;
+        http_cache_meta_init(&meta);
+        request_network(req, have ? &cached : NULL, &meta);
+
+        if (req->status == 304 && have) {
+            // Still valid: the stored body stands in for the response.
+            // Only a new max-age is worth a write to flash.
+            if (meta.max_age > 0) {
+                if (!meta.etag[0]) memcpy(meta.etag, cached.meta.etag, sizeof(meta.etag));
+                if (!meta.last_modified[0]) {
+                    memcpy(meta.last_modified, cached.meta.last_modified, sizeof(meta.last_modified));
+                }
+                http_cache_store(req->url, &meta, cached.body, cached.len);
+            }
+            req->status = 200;
+            req->cache = HTTP_CACHE_REVALIDATED;
+        } else {
+            if (req->status == 200 && req->use_cache) {
+                http_cache_store(req->url, &meta, req->body, req->body_len);
+            }
+            req->cache = req->use_cache ? HTTP_CACHE_MISS : HTTP_CACHE_BYPASS;
+            have = false;
+        }
+    }
+
+    if (have) {
+        req->body = cached.body;
+        req->body_len = cached.len < req->max_size ? cached.len : req->max_size;
+    } else {
+        free(cached.body);
+    }
+    ESP_LOGI(TAG, "%s: status %d, %d bytes, cache %s", req->url, req->status,
+             req->body_len, http_cache_status_name(req->cache));
+}
+
+// The body is only kept for these, and status stays 0 when no response came
+static bool request_ok(const http_request_t *req) {
+    return req->status >= 200 && req->status < 300;
+}
+
+// ============================================================================
+// Worker task
+// ============================================================================
+
+static void http_worker_task(void *arg) {
+    (void)arg;
+    http_request_t *req;
+    while (1) {
+        if (xQueueReceive(s_queue, &req, pdMS_TO_TICKS(HTTP_POOL_IDLE_MS)) != pdTRUE) {
+            // Quiet for a while: don't leave idle sockets open until the next request
+            http_pool_close_idle(false);
+            continue;
+        }
+        // Nobody is left to read the result of a collected future
+        if (atomic_load(&req->refs) > 1) {
+            atomic_store(&req->state, REQUEST_RUNNING);
+            request_perform(req);
+        } else {
+            snprintf(req->error, sizeof(req->error), "cancelled");
+        }
+        atomic_store(&req->state, REQUEST_DONE);
+        request_release(req);
+        lua_sched_notify();
+    }
+}
+
+static bool start_worker(void) {
+    if (s_queue != NULL) return true;
+    s_queue = xQueueCreate(HTTP_FETCH_QUEUE_LEN, sizeof(http_request_t *));
+    if (s_queue == NULL) return false;
+    xTaskCreatePinnedToCore(http_worker_task, "http_worker", HTTP_WORKER_STACK, NULL,
+                            HTTP_WORKER_PRIORITY, NULL, NET_TASK_CORE);
+    return true;
+}
+
+// ============================================================================
+// Lua bindings
+// ============================================================================
+
+// Fills in the request from the url at index 1 and the options table at opts
+static void read_request(lua_State *L, int opts, http_request_t *req) {
+    build_url(req->url, sizeof(req->url), lua_tostring(L, 1));
+    req->timeout_ms = HTTP_FETCH_TIMEOUT_MS;
+    req->max_size = HTTP_FETCH_MAX_SIZE;
+    req->use_cache = true;
+    if (lua_istable(L, opts)) {
+        lua_getfield(L, opts, "timeout");
+        req->timeout_ms = (int)luaL_optinteger(L, -1, req->timeout_ms);
+        lua_getfield(L, opts, "max_size");
+        req->max_size = (int)luaL_optinteger(L, -1, req->max_size);
+        lua_getfield(L, opts, "cache");
+        req->use_cache = lua_isnil(L, -1) || lua_toboolean(L, -1);
+        lua_pop(L, 3);
+        luaL_argcheck(L, req->timeout_ms > 0 && req->max_size > 0, opts,
+                      "timeout and max_size must be positive");
+    }
+    http_cache_init();
+    http_pool_init();
+}
+
+int lua_http_fetch(lua_State *LUA) {
+    if (lua_gettop(LUA) < 1 || !lua_isstring(LUA, 1)) {
+        lua_pushliteral(LUA, "http_fetch requires a URL string");
+        lua_error(LUA);
+        return 0;
+    }
+
+    http_request_t req = { 0 };
+    read_request(LUA, 2, &req);
+    ESP_LOGI(TAG, "http_fetch: %s", req.url);
+
+    request_perform(&req);
+    if (request_ok(&req)) {
+        lua_pushlstring(LUA, req.body, req.body_len);
+    } else {
+        if (req.status != 0) {
+            ESP_LOGE(TAG, "HTTP request failed with status %d", req.status);
+        }
+        lua_pushnil(LUA);
+    }
+    lua_pushstring(LUA, http_cache_status_name(req.cache));
+    free(req.body);
+    return 2;
+}
+
+static http_request_t *check_future(lua_State *L, int idx) {
+    return *(http_request_t **)luaL_checkudata(L, idx, FUTURE_META);
+}
+
+static bool request_done(void *arg) {
+    return atomic_load(&((http_request_t *)arg)->state) == REQUEST_DONE;
+}
+
+static int push_result(lua_State *L, int idx, http_request_t *req) {
+    if (!request_ok(req)) {
+        lua_pushnil(L);
+        if (req->error[0]) {
+            lua_pushstring(L, req->error);
+        } else {
+            lua_pushfstring(L, "HTTP status %d", req->status);
+        }
+        return 2;
+    }
+
+    // The body moves into a Lua string kept with the future, so the C copy
+    // is freed and repeated calls don't copy again
+    lua_getiuservalue(L, idx, 1);
+    if (lua_isnil(L, -1)) {
+        lua_pop(L, 1);
+        lua_pushlstring(L, req->body, req->body_len);
+        lua_pushvalue(L, -1);
+        lua_setiuservalue(L, idx, 1);
+        free(req->body);
+        req->body = NULL;
+    }
+    lua_pushinteger(L, req->status);
+    lua_pushstring(L, http_cache_status_name(req->cache));
+    return 3;
+}
+
+static int future_ready(lua_State *L) {
+    lua_pushboolean(L, request_done(check_future(L, 1)));
+    return 1;
+}
+
+static int future_result(lua_State *L) {
+    http_request_t *req = check_future(L, 1);
+    if (!request_done(req)) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "pending");
+        return 2;
+    }
+    return push_result(L, 1, req);
+}
+
+// Stack: future, timeout, deadline (esp_timer time, 0 = none)
+static int future_await_k(lua_State *L, int status, lua_KContext ctx) {
+    (void)status;
+    http_request_t *req = check_future(L, 1);
+    if (request_done(req)) {
+        return push_result(L, 1, req);
+    }
+    int64_t deadline = (int64_t)lua_tointeger(L, 3);
+    if (deadline != 0 && esp_timer_get_time() >= deadline) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "timeout");
+        return 2;
+    }
+    return lua_sched_wait_event(L, deadline, request_done, req, ctx, future_await_k);
+}
+
+static int future_await(lua_State *L) {
+    check_future(L, 1);
+    lua_Integer timeout_ms = luaL_optinteger(L, 2, 0);
+    lua_settop(L, 2);
+    lua_pushinteger(L, timeout_ms > 0 ? esp_timer_get_time() + timeout_ms * 1000 : 0);
+    return future_await_k(L, LUA_OK, 0);
+}
+
+static int future_gc(lua_State *L) {
+    http_request_t **box = (http_request_t **)luaL_checkudata(L, 1, FUTURE_META);
+    if (*box != NULL) {
+        request_release(*box);
+        *box = NULL;
+    }
+    return 0;
+}
+
+static void push_future_meta(lua_State *L) {
+    if (luaL_newmetatable(L, FUTURE_META)) {
+        static const luaL_Reg methods[] = {
+            { "ready", future_ready },
+            { "result", future_result },
+            { "await", future_await },
+            { NULL, NULL },
+        };
+        luaL_newlib(L, methods);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, future_gc);
+        lua_setfield(L, -2, "__gc");
+    }
+}
+
+int lua_http_fetch_async(lua_State *LUA) {
+    luaL_checkstring(LUA, 1);
+    http_request_t request = { 0 };
+    read_request(LUA, 2, &request);
+
+    if (!start_worker()) {
+        return luaL_error(LUA, "cannot start the HTTP worker");
+    }
+
+    // The future is created empty first: once it has its __gc, nothing
+    // below can raise a Lua error, so req can't leak or be left with the
+    // worker unreleased
+    http_request_t **box = lua_newuserdatauv(LUA, sizeof(*box), 1);
+    *box = NULL;
+    push_future_meta(LUA);
+    lua_setmetatable(LUA, -2);
+
+    http_request_t *req = calloc(1, sizeof(*req));
+    if (req == NULL) {
+        return luaL_error(LUA, "out of memory");
+    }
+    *req = request;
+    atomic_init(&req->state, REQUEST_QUEUED);
+    atomic_init(&req->refs, 2);
+    *box = req;
+
+    if (xQueueSend(s_queue, &req, 0) != pdTRUE) {
+        // The future owns the only reference now; it still answers
+        // result() with the error
+        atomic_fetch_sub(&req->refs, 1);
+        snprintf(req->error, sizeof(req->error), "request queue full");
+        atomic_store(&req->state, REQUEST_DONE);
+        lua_pushnil(LUA);
+        lua_pushliteral(LUA, "request queue full");
+        return 2;
+    }
+    ESP_LOGD(TAG, "Queued %s", req->url);
+    return 1;
+}
+
+// ============================================================================
+// Streaming
+// ============================================================================
+
+// Script file names are relative to LUA_FILE_PATH; refuse to leave it
+static bool asset_path(const char *name, char *out, size_t len) {
+    if (name[0] == '\0' || name[0] == '/' || strstr(name, "..") != NULL) {
+        return false;
+    }
+    int n = snprintf(out, len, LUA_FILE_PATH "/%s", name);
+    return n > 0 && (size_t)n < len;
+}
+
+// Stack: sink, buffer, length
+static int call_sink(lua_State *L) {
+    const char *buffer = lua_touserdata(L, 2);
+    lua_pushlstring(L, buffer, (size_t)lua_tointeger(L, 3));
+    lua_replace(L, 2);
+    lua_settop(L, 2);
+    lua_call(L, 1, 1);
+    return 1;
+}
+
+int lua_http_stream(lua_State *LUA) {
+    luaL_checkstring(LUA, 1);
+    bool to_file = lua_type(LUA, 2) == LUA_TSTRING;
+    luaL_argexpected(LUA, to_file || lua_isfunction(LUA, 2), 2, "function or file name");
+
+    http_request_t req = { 0 };
+    read_request(LUA, 3, &req);
+
+    char path[160], tmp[168];
+    if (to_file && !asset_path(lua_tostring(LUA, 2), path, sizeof(path))) {
+        return luaL_argerror(LUA, 2, "invalid file name");
+    }
+    ESP_LOGI(TAG, "http_stream: %s", req.url);
+
+    response_info_t info = { 0 };
+    int content_length;
+    esp_http_client_handle_t client = request_start(&req, &info, NULL, &content_length);
+    if (client == NULL) {
+        lua_pushnil(LUA);
+        lua_pushstring(LUA, req.error);
+        return 2;
+    }
+    req.status = esp_http_client_get_status_code(client);
+
+    FILE *fp = NULL;
+    char *buffer = NULL;
+    const char *error = NULL;
+    if (!request_ok(&req)) {
+        snprintf(req.error, sizeof(req.error), "HTTP status %d", req.status);
+        error = req.error;
+    } else if ((buffer = malloc(HTTP_STREAM_CHUNK)) == NULL) {
+        error = "out of memory";
+    } else if (to_file) {
+        // Write under a temporary name so a failed download keeps the old file
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+        fp = fopen(tmp, "wb");
+        if (fp == NULL) error = "can't create file";
+    }
+
+    // One buffer carries the whole body through, chunk by chunk
+    size_t total = 0;
+    while (error == NULL) {
+        int len = esp_http_client_read(client, buffer, HTTP_STREAM_CHUNK);
+        if (len < 0) {
+            error = "read failed";
+            break;
+        }
+        if (len == 0) {
+            // A connection closed early reads as a clean end too
+            if (!esp_http_client_is_complete_data_received(client)) {
+                error = "connection closed before the end of the body";
+            }
+            break;
+        }
+        total += len;
+
+        if (fp != NULL) {
+            if (fwrite(buffer, 1, len, fp) != (size_t)len) {
+                error = "write failed";
+            }
+            continue;
+        }
+
+        // The chunk is made into a string and handed to the callback in
+        // protected mode, so neither running out of memory nor the callback's
+        // errors can leak the connection; they are raised again once
+        // everything is closed
+        lua_pushcfunction(LUA, call_sink);
+        lua_pushvalue(LUA, 2);
+        lua_pushlightuserdata(LUA, buffer);
+        lua_pushinteger(LUA, len);
+        if (lua_pcall(LUA, 3, 1, 0) != LUA_OK) {
+            free(buffer);
+            http_pool_release(client, false);
+            return lua_error(LUA);
+        }
+        if (lua_isboolean(LUA, -1) && !lua_toboolean(LUA, -1)) {
+            error = "aborted";
+        }
+        lua_pop(LUA, 1);
+    }
+
+    free(buffer);
+    http_pool_release(client, error == NULL && can_keep(client, &info));
+
+    if (fp != NULL) {
+        bool ok = (fclose(fp) == 0) && error == NULL;
+        if (ok) {
+            remove(path);
+            ok = rename(tmp, path) == 0;
+            if (!ok) error = "write failed";
+        }
+        if (!ok) remove(tmp);
+    }
+
+    ESP_LOGI(TAG, "%s: status %d, streamed %u bytes%s%s", req.url, req.status,
+             (unsigned)total, error ? ", " : "", error ? error : "");
+    if (error != NULL) {
+        lua_pushnil(LUA);
+        lua_pushstring(LUA, error);
+        return 2;
+    }
+    lua_pushinteger(LUA, (lua_Integer)total);
+    lua_pushinteger(LUA, req.status);
+    return 2;
+}
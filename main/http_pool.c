@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "http_pool.h"
+
+static const char* TAG = "http_pool";
+
+typedef struct {
+    esp_http_client_handle_t client;  // NULL = free slot
+    char host[96];          // scheme://host:port
+    int64_t last_used;      // esp_timer time it was released
+    bool in_use;
+} pool_entry_t;
+
+static SemaphoreHandle_t s_lock;
+static pool_entry_t s_pool[HTTP_POOL_MAX];
+
+// "http://example.com:8080/path" -> "http://example.com:8080"
+static void host_key(const char *url, char *out, size_t len) {
+    const char *host = strstr(url, "://");
+    host = host ? host + 3 : url;
+    size_t n = strcspn(host, "/?#") + (host - url);
+    if (n >= len) n = len - 1;
+    memcpy(out, url, n);
+    out[n] = '\0';
+}
+
+static void entry_close(pool_entry_t *e) {
+    esp_http_client_close(e->client);
+    esp_http_client_cleanup(e->client);
+    memset(e, 0, sizeof(*e));
+}
+
+void http_pool_init(void) {
+    if (s_lock == NULL) {
+        s_lock = xSemaphoreCreateMutex();
+    }
+}
+
+void http_pool_close_idle(bool all) {
+    int64_t now = esp_timer_get_time();
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < HTTP_POOL_MAX; i++) {
+        pool_entry_t *e = &s_pool[i];
+        if (e->client != NULL && !e->in_use &&
+            (all || now - e->last_used >= (int64_t)HTTP_POOL_IDLE_MS * 1000)) {
+            ESP_LOGD(TAG, "Closing idle connection to %s", e->host);
+            entry_close(e);
+        }
+    }
+    xSemaphoreGive(s_lock);
+}
+
+esp_http_client_handle_t http_pool_acquire(const char *url, int timeout_ms,
+                                           http_event_handle_cb event_handler,
+                                           void *user_data, bool *reused) {
+    char host[sizeof(s_pool[0].host)];
+    host_key(url, host, sizeof(host));
+    *reused = false;
+    http_pool_close_idle(false);
+
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    pool_entry_t *slot = NULL;
+    pool_entry_t *oldest = NULL;
+    for (int i = 0; i < HTTP_POOL_MAX; i++) {
+        pool_entry_t *e = &s_pool[i];
+        if (e->client == NULL) {
+            if (slot == NULL) slot = e;
+        } else if (!e->in_use) {
+            if (strcmp(e->host, host) == 0) {
+                e->in_use = true;
+                xSemaphoreGive(s_lock);
+
+                esp_http_client_set_url(e->client, url);
+                esp_http_client_set_timeout_ms(e->client, timeout_ms);
+                esp_http_client_set_user_data(e->client, user_data);
+                *reused = true;
+                return e->client;
+            }
+            if (oldest == NULL || e->last_used < oldest->last_used) oldest = e;
+        }
+    }
+    if (slot == NULL && oldest != NULL) {
+        // Full: give up the least recently used connection to another host
+        // rather than open a socket beyond the pool
+        ESP_LOGD(TAG, "Closing %s to make room", oldest->host);
+        entry_close(oldest);
+        slot = oldest;
+    }
+
+    esp_http_client_config_t config = {
+        .url = url,
+        .timeout_ms = timeout_ms,
+        .event_handler = event_handler,
+        .user_data = user_data,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client != NULL && slot != NULL) {
+        // Without a slot (all busy) the handle is used once and freed
+        slot->client = client;
+        slot->in_use = true;
+        snprintf(slot->host, sizeof(slot->host), "%s", host);
+    }
+    xSemaphoreGive(s_lock);
+    return client;
+}
+
+void http_pool_release(esp_http_client_handle_t client, bool keep) {
+    xSemaphoreTake(s_lock, portMAX_DELAY);
+    for (int i = 0; i < HTTP_POOL_MAX; i++) {
+        pool_entry_t *e = &s_pool[i];
+        if (e->client == client) {
+            if (keep) {
+                e->in_use = false;
+                e->last_used = esp_timer_get_time();
+                esp_http_client_set_user_data(client, NULL);
+                xSemaphoreGive(s_lock);
+                return;
+            }
+            memset(e, 0, sizeof(*e));
+            break;
+        }
+    }
+    xSemaphoreGive(s_lock);
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+}
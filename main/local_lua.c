@@ -3,26 +3,39 @@
 #include <lualib.h>
 #include <ctype.h>
 #include <lua.h>
+#include <stdatomic.h>
 #include <string.h>
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "local_lua.h"
+#include "lua_alloc.h"
+#include "lua_cache.h"
+#include "lua_sched.h"
 #include "esp_heap_caps.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "display.h"
+#include "font.h"
+#include "frame_gc.h"
 #include "luafuncs.h"
+#include "raster.h"
+#include "task_topology.h"
 
 static const char* TAG = "lua";
 
-extern bool force_exit;
+// Requests for the running script, set from any task and consumed by the
+// debug hook. Keeping them in one word makes the hook's common case a
+// single load and test.
+static _Atomic uint32_t s_signals;
 
-// Pause request from HTTP server - when set, Lua yields to let HTTP run
-static volatile int s_pause_duration_ms = 0;
+void lua_signal(uint32_t bits) {
+    atomic_fetch_or_explicit(&s_signals, bits, memory_order_relaxed);
+    // Tasks waiting in the scheduler are not running the hook
+    lua_sched_notify();
+}
 
-// Request Lua to pause execution for HTTP
-void lua_request_pause(int duration_ms) {
-    s_pause_duration_ms = duration_ms;
+void lua_request_exit(void) {
+    lua_signal(LUA_SIGNAL_EXIT);
 }
 
 // Error display colors
@@ -44,7 +57,7 @@ static const char *sanitize_error_msg(const char *input) {
     if (input == NULL) return NULL;
 
     // Check for /assets/display.lua:<number>: pattern and replace with "line <number>:"
-    const char *file_prefix = "/assets/display.lua:";
+    const char *file_prefix = LUA_FILE_PATH "/display.lua:";
     const char *match = strstr(input, file_prefix);
     if (match) {
         // Skip to after the file path
@@ -88,6 +101,8 @@ static const char *sanitize_error_msg(const char *input) {
 // Display a Lua error on the LED panel
 // Wraps long error messages across multiple lines
 static void show_lua_error(const char *error_msg) {
+    // Draw straight onto the panel even if the script was in frame mode
+    display_end_frames();
     clear_display();
 
     // Show "ERROR" title in red using 8x8 font
@@ -158,56 +173,116 @@ int lua_panic_func(lua_State *L) {
 // Minimum free heap before Lua starts yielding to let other tasks run
 #define LUA_LOW_MEMORY_THRESHOLD 16384
 
+// How often the memory watcher samples the heap, and how often it logs
+#define LUA_WATCH_PERIOD_MS 250
+#define LUA_WATCH_LOG_MS 5000
+
+// The hook runs every s_hook_count VM instructions. The count is doubled
+// while the hook fires several times per tick (a busy script) and halved
+// when a few ticks go by between calls (a script that mostly waits in C),
+// so signals are seen within a couple of ticks either way.
+#define LUA_HOOK_MIN_COUNT 1000
+#define LUA_HOOK_MAX_COUNT 128000
+
+static int s_hook_count = LUA_HOOK_MIN_COUNT;
+static TickType_t s_hook_tick;
+
+static void debug_hook(lua_State *LUA, lua_Debug *dbg);
+
+static void adapt_hook(lua_State *LUA) {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t elapsed = now - s_hook_tick;
+    s_hook_tick = now;
+
+    int count = s_hook_count;
+    if (elapsed == 0 && count < LUA_HOOK_MAX_COUNT) {
+        count *= 2;
+    } else if (elapsed > 2 && count > LUA_HOOK_MIN_COUNT) {
+        count /= 2;
+    }
+    if (count != s_hook_count) {
+        s_hook_count = count;
+        lua_sethook(LUA, debug_hook, LUA_MASKCOUNT, count);
+        ESP_LOGD(TAG, "Hook interval now %d instructions", count);
+    }
+}
+
 // lua vm debug callback to avoid watchdog bites
 static void debug_hook(lua_State *LUA, lua_Debug *dbg){
 	(void)dbg;
 
-    // Check if HTTP explicitly requested a pause
-    if (s_pause_duration_ms > 0) {
-        lua_gc(LUA,LUA_GCCOLLECT);
-        s_pause_duration_ms = 0;  // Clear the request
-        lua_pushstring(LUA, "Pausing for web...");
-        lua_error(LUA);
+    adapt_hook(LUA);
+    lua_check_signals(LUA);
+}
 
-        int pause_ms = s_pause_duration_ms;
-        s_pause_duration_ms = 0;  // Clear the request
-        ESP_LOGI(TAG, "Lua pausing for %dms (HTTP request)", pause_ms);
-        vTaskDelay(pdMS_TO_TICKS(pause_ms));
+void lua_check_signals(lua_State *LUA) {
+    if (atomic_load_explicit(&s_signals, memory_order_relaxed) == 0) {
+        return;
     }
+    uint32_t signals = atomic_exchange_explicit(&s_signals, 0, memory_order_relaxed);
 
-    // Auto-yield when memory is low to give HTTP server a chance
-    size_t free_heap = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
-    if (free_heap < LUA_LOW_MEMORY_THRESHOLD) {
-        // Yield briefly to let other tasks (HTTP) have a go
-        vTaskDelay(pdMS_TO_TICKS(10));
+    // Near the memory budget: collect before allocations start failing
+    if (signals & LUA_SIGNAL_GC) {
+        lua_alloc_relieve_pressure(LUA);
     }
 
-    // Log memory usage every 5 seconds
-    static int64_t last_log_time = 0;
-    int64_t now = esp_timer_get_time();
-    if (now - last_log_time >= 5000000) {  // 5 seconds in microseconds
-        last_log_time = now;
-        log_memory_usage("DBG");
+    // Auto-yield when memory is low to give HTTP server a chance
+    if (signals & LUA_SIGNAL_LOW_MEMORY) {
+        vTaskDelay(pdMS_TO_TICKS(10));
     }
 
-    if(force_exit) {
-        force_exit = false;
+    if (signals & LUA_SIGNAL_EXIT) {
         lua_pushstring(LUA, "LUA Restarting...");
         lua_error(LUA);
     }
 }
 
+// Low priority task that keeps heap walks out of the Lua task: flags low
+// memory to the hook and logs usage every few seconds, and task stacks
+// every STACK_REPORT_MS
+static void memory_watch_task(void *arg) {
+    (void)arg;
+    int ms_since_log = 0;
+    int ms_since_stacks = 0;
+    while (1) {
+        size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
+        if (largest < LUA_LOW_MEMORY_THRESHOLD) {
+            lua_signal(LUA_SIGNAL_LOW_MEMORY);
+        }
+
+        ms_since_log += LUA_WATCH_PERIOD_MS;
+        if (ms_since_log >= LUA_WATCH_LOG_MS) {
+            ms_since_log = 0;
+            log_memory_usage("DBG");
+        }
+        ms_since_stacks += LUA_WATCH_PERIOD_MS;
+        if (STACK_REPORT_MS > 0 && ms_since_stacks >= STACK_REPORT_MS) {
+            ms_since_stacks = 0;
+            task_topology_report_stacks();
+        }
+        vTaskDelay(pdMS_TO_TICKS(LUA_WATCH_PERIOD_MS));
+    }
+}
+
+static void start_memory_watch(void) {
+    static bool started = false;
+    if (started) return;
+    started = true;
+    xTaskCreatePinnedToCore(memory_watch_task, "lua_memwatch", MEMWATCH_TASK_STACK, NULL, tskIDLE_PRIORITY + 1,
+                            NULL, NET_TASK_CORE);
+}
+
 
 
 lua_State * lua_init(void){
 
-    lua_State* LUA = luaL_newstate();
+    lua_State* LUA = lua_alloc_newstate();
 
     if (LUA == NULL) {
         ESP_LOGE(TAG, "Failed to create new Lua state");
         return NULL;
     }
-    log_memory_usage("After luaL_newstate");
+    log_memory_usage("After lua_newstate");
 
     lua_atpanic( LUA, lua_panic_func);
 
@@ -216,14 +291,21 @@ lua_State * lua_init(void){
     load_lua_funcs(LUA);
 
 	// setup debug hook callback
-	lua_sethook(LUA, debug_hook, LUA_MASKCOUNT, 1000);
+	s_hook_count = LUA_HOOK_MIN_COUNT;
+	lua_sethook(LUA, debug_hook, LUA_MASKCOUNT, s_hook_count);
+	start_memory_watch();
     
     // Set the Lua module search path to include the assets directory
-    if (luaL_dostring(LUA, "package.path = package.path .. ';./?.lua;/assets/?.lua'")) {
+    if (luaL_dostring(LUA, "package.path = package.path .. ';./?.lua;" LUA_FILE_PATH "/?.lua'")) {
         ESP_LOGE(TAG, "Failed to set package.path: %s", lua_tostring(LUA, -1));
         lua_pop(LUA, 1); // Remove error message from the stack
     }
-    
+
+    // require() loads modules through the bytecode cache
+    lua_cache_install_searcher(LUA);
+
+    lua_sched_init();
+
     lua_gc(LUA,LUA_GCGEN);
 
 
@@ -231,6 +313,185 @@ lua_State * lua_init(void){
 
 }
 
+// ============================================================================
+// Warm restart
+// ============================================================================
+
+// Registry keys for the snapshot of the pristine environment taken right
+// after lua_init(): shallow copies of _G and package.loaded, and of every
+// table reachable from them, keyed by the table itself.
+#define SNAPSHOT_GLOBALS "luamatrix.snapshot.globals"
+#define SNAPSHOT_LOADED "luamatrix.snapshot.loaded"
+#define SNAPSHOT_LIBS "luamatrix.snapshot.libs"
+
+// VM kept alive between scripts in warm restart mode
+static lua_State *s_lua = NULL;
+
+// Pushes a shallow copy of the table at idx
+static void copy_table(lua_State *L, int idx) {
+    idx = lua_absindex(L, idx);
+    lua_newtable(L);
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, -4);
+    }
+}
+
+// Adds a copy of every table reachable from the table at idx to the libs
+// table, so nested ones like package.preload and package.searchers are
+// restored by content too. _G is restored on its own and skipped; a table
+// already in libs is not descended into again.
+static void snapshot_libs(lua_State *L, int libs, int idx) {
+    idx = lua_absindex(L, idx);
+    luaL_checkstack(L, 6, "snapshot nesting");
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        if (lua_istable(L, -1)) {
+            lua_pushglobaltable(L);
+            bool is_globals = lua_rawequal(L, -1, -2);
+            lua_pop(L, 1);
+            lua_pushvalue(L, -1);
+            if (!is_globals && lua_rawget(L, libs) == LUA_TNIL) {
+                lua_pop(L, 1);
+                lua_pushvalue(L, -1);
+                copy_table(L, -1);
+                lua_rawset(L, libs);
+                snapshot_libs(L, libs, -1);
+            } else {
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+    }
+}
+
+static void take_snapshot(lua_State *L) {
+    lua_newtable(L);
+    int libs = lua_gettop(L);
+    lua_pushglobaltable(L);
+    int globals = lua_gettop(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    int loaded = lua_gettop(L);
+
+    snapshot_libs(L, libs, globals);
+    snapshot_libs(L, libs, loaded);
+
+    // The string metatable is shared by every string; keep it too
+    lua_pushliteral(L, "");
+    if (lua_getmetatable(L, -1)) {
+        copy_table(L, -1);
+        lua_rawset(L, libs);
+    }
+    lua_pop(L, 1);
+
+    copy_table(L, globals);
+    lua_setfield(L, LUA_REGISTRYINDEX, SNAPSHOT_GLOBALS);
+    copy_table(L, loaded);
+    lua_setfield(L, LUA_REGISTRYINDEX, SNAPSHOT_LOADED);
+    lua_pushvalue(L, libs);
+    lua_setfield(L, LUA_REGISTRYINDEX, SNAPSHOT_LIBS);
+    lua_settop(L, libs - 1);
+}
+
+// Makes the table at idx an exact copy of the table at copy_idx again
+static void restore_table(lua_State *L, int idx, int copy_idx) {
+    idx = lua_absindex(L, idx);
+    copy_idx = lua_absindex(L, copy_idx);
+
+    // Clearing existing fields is allowed while traversing
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        lua_pop(L, 1);
+        lua_pushvalue(L, -1);
+        if (lua_rawget(L, copy_idx) == LUA_TNIL) {
+            lua_pushvalue(L, -2);
+            lua_pushnil(L);
+            lua_rawset(L, idx);
+        }
+        lua_pop(L, 1);
+    }
+
+    lua_pushnil(L);
+    while (lua_next(L, copy_idx)) {
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, idx);
+    }
+
+    // None of the pristine tables has a metatable
+    lua_pushnil(L);
+    lua_setmetatable(L, idx);
+}
+
+// Puts the VM back into the state it had right after lua_init()
+static void restore_snapshot(lua_State *L) {
+    lua_settop(L, 0);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, SNAPSHOT_LIBS);
+    lua_pushnil(L);
+    while (lua_next(L, 1)) {
+        restore_table(L, -2, -1);
+        lua_pop(L, 1);
+    }
+    lua_pop(L, 1);
+
+    lua_pushglobaltable(L);
+    lua_getfield(L, LUA_REGISTRYINDEX, SNAPSHOT_GLOBALS);
+    restore_table(L, 1, 2);
+    lua_settop(L, 0);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_getfield(L, LUA_REGISTRYINDEX, SNAPSHOT_LOADED);
+    restore_table(L, 1, 2);
+    lua_settop(L, 0);
+
+    // Undo whatever the script did to the hook and the collector, then
+    // drop everything it left behind
+    s_hook_count = LUA_HOOK_MIN_COUNT;
+    lua_sethook(L, debug_hook, LUA_MASKCOUNT, s_hook_count);
+    lua_gc(L, LUA_GCRESTART);
+    lua_gc(L, LUA_GCGEN);
+    lua_gc(L, LUA_GCCOLLECT);
+}
+
+// Returns a clean VM: the kept one reset from its snapshot, or a new one
+static lua_State *lua_acquire(void) {
+#if LUA_WARM_RESTART
+    if (s_lua != NULL) {
+        int64_t start = esp_timer_get_time();
+        restore_snapshot(s_lua);
+        ESP_LOGI(TAG, "Warm restart took %d us", (int)(esp_timer_get_time() - start));
+        return s_lua;
+    }
+#endif
+
+    lua_State *L = lua_init();
+    if (L == NULL) return NULL;
+#if LUA_WARM_RESTART
+    take_snapshot(L);
+    s_lua = L;
+#endif
+    return L;
+}
+
+// Hands the VM back after a script. Unless keep is set it is closed, so the
+// next script starts from a brand new one.
+static void lua_release(lua_State *L, bool keep) {
+#if LUA_WARM_RESTART
+    if (keep) {
+        lua_settop(L, 0);
+        return;
+    }
+    s_lua = NULL;
+#endif
+    (void)keep;
+    lua_close(L);
+    lua_alloc_trim();
+    log_memory_usage("After lua_close");
+}
+
 // Function to run a Lua script from file
 void run_lua_file(const char* file_name)
 {
@@ -238,20 +499,24 @@ void run_lua_file(const char* file_name)
 
     log_memory_usage("Start of test");
 
-    lua_State* L = lua_init();
+    lua_State* L = lua_acquire();
     if (L == NULL) {
         show_lua_error("Failed to create Lua state (out of memory?)");
         vTaskDelay(pdMS_TO_TICKS(3000));
         return;
     }
+    lua_alloc_reset_stats();
+    // A limit the last script set with set_mem_limit() ends with it
+    lua_alloc_set_budget(0);
 
-    if (luaL_dostring(L, "clear_display()") == LUA_OK) {
+    int status = luaL_dostring(L, "clear_display()");
+    if (status == LUA_OK) {
         lua_pop(L, lua_gettop(L));
     } else {
         const char *err_msg = lua_tostring(L, -1);
         ESP_LOGE(TAG, "Error running embedded Lua script: %s", err_msg);
         show_lua_error(err_msg);
-        lua_close(L);
+        lua_release(L, false);
         vTaskDelay(pdMS_TO_TICKS(3000));
         return;
     }
@@ -260,12 +525,38 @@ void run_lua_file(const char* file_name)
     char full_path[128];
     snprintf(full_path, sizeof(full_path), LUA_FILE_PATH "/%s", file_name);
 
-    if (luaL_dofile(L, full_path) == LUA_OK) {
+    // Load through the bytecode cache, then run. luaL_dofile() would only
+    // report success or failure; the status is needed to tell an
+    // out-of-memory error apart
+    status = lua_cache_loadfile(L, full_path);
+    if (status == LUA_OK) {
+        status = lua_pcall(L, 0, 0, 0);
+    }
+    if (status == LUA_OK) {
+        // Tasks the script spawned keep running after its main chunk
+        lua_pushcfunction(L, lua_sched_run);
+        status = lua_pcall(L, 0, 0, 0);
+    }
+    if (status == LUA_OK) {
         lua_pop(L, lua_gettop(L));
     } else {
         const char *err_msg = lua_tostring(L, -1);
         ESP_LOGE(TAG, "Error running Lua script from file '%s': %s", full_path, err_msg);
 
+        // Lua's own message does not say which limit was hit
+        char mem_msg[64];
+        lua_alloc_stats_t st;
+        lua_alloc_get_stats(&st);
+        if (status == LUA_ERRMEM && st.limit_hits > 0) {
+            snprintf(mem_msg, sizeof(mem_msg), "Out of memory: script limit is %u KB",
+                (unsigned)(st.budget / 1024));
+            err_msg = mem_msg;
+        } else if (status == LUA_ERRMEM && st.reserve_hits > 0) {
+            snprintf(mem_msg, sizeof(mem_msg), "Out of memory: %u KB kept for web UI",
+                (unsigned)(LUA_ALLOC_HEAP_RESERVE / 1024));
+            err_msg = mem_msg;
+        }
+
         // Show error on the LED panel
         show_lua_error(err_msg);
 
@@ -275,9 +566,18 @@ void run_lua_file(const char* file_name)
         vTaskDelay(pdMS_TO_TICKS(3000));
     }
     log_memory_usage("After executing Lua script from file");
+    lua_alloc_log_stats(file_name);
 
-    lua_close(L);
-    log_memory_usage("After lua_close");
+    lua_sched_reset(L);
+
+    // A VM that ran out of memory is thrown away; its heap is likely too
+    // fragmented to be worth keeping
+    lua_release(L, status != LUA_ERRMEM);
+
+    display_end_frames();
+    frame_gc_reset();
+    font_close_all();
+    raster_set_antialias(false);
 
     ESP_LOGI(TAG, "End of %s", file_name);
 }
\ No newline at end of file
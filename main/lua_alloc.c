@@ -0,0 +1,414 @@
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "esp_timer.h"
+#include "frame_gc.h"
+#include "local_lua.h"
+#include "lua_alloc.h"
+
+static const char* TAG = "lua_alloc";
+
+// Slabs are aligned to their size, so the slab a block belongs to is found
+// by masking its address. Lua passes the old size on every free and
+// resize, which picks the size class; blocks carry no header of their own.
+#define SLAB_SIZE 4096
+#define SLAB_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+
+typedef struct slab {
+    struct slab *next;   // neighbours in the class's list of slabs with room
+    struct slab *prev;
+    void *free;          // returned blocks, linked through their first word
+    uint16_t used;       // blocks handed out
+    uint16_t carved;     // blocks ever handed out; the ones after are untouched
+    uint8_t cls;
+} slab_t;
+
+// Keeps blocks 8-byte aligned, as Lua expects for doubles and 64-bit ints
+#define SLAB_HEADER ((sizeof(slab_t) + 15) & ~(size_t)15)
+
+// Multiples of 8, denser where Lua's strings, closures and table nodes fall
+static const uint16_t s_class_size[] = {16, 24, 32, 40, 48, 64, 80, 96, 128, 160, 192, 256};
+#define CLASS_COUNT (sizeof(s_class_size) / sizeof(s_class_size[0]))
+
+typedef struct {
+    slab_t *partial;     // slabs with at least one free block
+    uint16_t per_slab;
+} size_class_t;
+
+static size_class_t s_classes[CLASS_COUNT];
+static uint8_t s_class_of[LUA_ALLOC_MAX_SMALL / 8 + 1];  // indexed by (size + 7) / 8
+static lua_alloc_stats_t s_stats;
+static size_t s_default_budget;
+static bool s_ready;
+
+// Usage at which the hook is asked to collect; SIZE_MAX without a budget
+static size_t s_minor_gc_at = SIZE_MAX;
+static size_t s_full_gc_at = SIZE_MAX;
+
+static void set_budget(size_t bytes) {
+    s_stats.budget = bytes;
+    s_minor_gc_at = bytes ? bytes / 100 * LUA_ALLOC_MINOR_GC_PERCENT : SIZE_MAX;
+    s_full_gc_at = bytes ? bytes / 100 * LUA_ALLOC_FULL_GC_PERCENT : SIZE_MAX;
+}
+
+static void alloc_init(void) {
+    unsigned cls = 0;
+    for (unsigned i = 0; i < sizeof(s_class_of); i++) {
+        while (s_class_size[cls] < i * 8) cls++;
+        s_class_of[i] = cls;
+    }
+    for (cls = 0; cls < CLASS_COUNT; cls++) {
+        s_classes[cls].per_slab = (SLAB_SIZE - SLAB_HEADER) / s_class_size[cls];
+    }
+
+    s_stats.psram = heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0;
+    if (LUA_ALLOC_BUDGET != 0) {
+        s_default_budget = LUA_ALLOC_BUDGET;
+    } else {
+        size_t free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+        s_default_budget = free_bytes / 100 * LUA_ALLOC_BUDGET_PERCENT;
+    }
+    set_budget(s_default_budget);
+    ESP_LOGI(TAG, "Budget %u bytes, large blocks in %s",
+        (unsigned)s_stats.budget, s_stats.psram ? "PSRAM" : "internal RAM");
+    s_ready = true;
+}
+
+static inline unsigned class_of(size_t size) {
+    return s_class_of[(size + 7) / 8];
+}
+
+static void slab_link(size_class_t *c, slab_t *slab) {
+    slab->prev = NULL;
+    slab->next = c->partial;
+    if (c->partial) c->partial->prev = slab;
+    c->partial = slab;
+}
+
+static void slab_unlink(size_class_t *c, slab_t *slab) {
+    if (slab->prev) slab->prev->next = slab->next;
+    else c->partial = slab->next;
+    if (slab->next) slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static void slab_release(size_class_t *c, slab_t *slab) {
+    slab_unlink(c, slab);
+    heap_caps_free(slab);
+    s_stats.slabs--;
+    s_stats.slab_bytes -= SLAB_SIZE;
+}
+
+// True if size bytes of internal RAM can go to Lua without eating into
+// the reserve kept for the rest of the firmware
+static bool internal_room(size_t size) {
+    if (heap_caps_get_free_size(MALLOC_CAP_INTERNAL) >= size + LUA_ALLOC_HEAP_RESERVE) {
+        return true;
+    }
+    s_stats.reserve_hits++;
+    return false;
+}
+
+static void *small_alloc(unsigned cls) {
+    size_class_t *c = &s_classes[cls];
+    slab_t *slab = c->partial;
+    if (slab == NULL) {
+        if (!internal_room(SLAB_SIZE)) return NULL;
+        slab = heap_caps_aligned_alloc(SLAB_SIZE, SLAB_SIZE, SLAB_CAPS);
+        if (slab == NULL) return NULL;
+        memset(slab, 0, sizeof(*slab));
+        slab->cls = cls;
+        slab_link(c, slab);
+        s_stats.slabs++;
+        s_stats.slab_bytes += SLAB_SIZE;
+    }
+
+    void *block = slab->free;
+    if (block != NULL) {
+        slab->free = *(void **)block;
+    } else {
+        block = (uint8_t *)slab + SLAB_HEADER + (size_t)slab->carved * s_class_size[cls];
+        slab->carved++;
+    }
+    if (++slab->used == c->per_slab) {
+        slab_unlink(c, slab);
+    }
+    s_stats.slab_used += s_class_size[cls];
+    return block;
+}
+
+static void small_free(void *block) {
+    slab_t *slab = (slab_t *)((uintptr_t)block & ~(uintptr_t)(SLAB_SIZE - 1));
+    size_class_t *c = &s_classes[slab->cls];
+
+    if (slab->used == c->per_slab) {
+        slab_link(c, slab);
+    }
+    *(void **)block = slab->free;
+    slab->free = block;
+    slab->used--;
+    s_stats.slab_used -= s_class_size[slab->cls];
+
+    // An empty slab is returned to the heap unless it is the only one the
+    // class has, so a block freed and allocated in a loop does not churn
+    if (slab->used == 0 && (c->partial != slab || slab->next != NULL)) {
+        slab_release(c, slab);
+    }
+}
+
+static void count_large(void *block, size_t size, bool add) {
+    if (add) {
+        s_stats.large_bytes += size;
+        if (esp_ptr_external_ram(block)) s_stats.psram_bytes += size;
+    } else {
+        s_stats.large_bytes -= size;
+        if (esp_ptr_external_ram(block)) s_stats.psram_bytes -= size;
+    }
+}
+
+static void *large_alloc(size_t size) {
+    void *block = NULL;
+    if (s_stats.psram) {
+        block = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    }
+    if (block == NULL && internal_room(size)) {
+        block = heap_caps_malloc(size, MALLOC_CAP_DEFAULT);
+    }
+    if (block != NULL) count_large(block, size, true);
+    return block;
+}
+
+static void *large_realloc(void *block, size_t osize, size_t nsize) {
+    void *moved = NULL;
+    if (s_stats.psram) {
+        moved = heap_caps_realloc(block, nsize, MALLOC_CAP_SPIRAM);
+    }
+    // Growth of an internal block, or all of a block moving in from PSRAM,
+    // has to fit above the reserve
+    size_t need = esp_ptr_external_ram(block) ? nsize : nsize > osize ? nsize - osize : 0;
+    if (moved == NULL && (need == 0 || internal_room(need))) {
+        moved = heap_caps_realloc(block, nsize, MALLOC_CAP_DEFAULT);
+    }
+    if (moved == NULL) return NULL;
+    // The old block is gone by now, but its address still tells where it was
+    count_large(block, osize, false);
+    count_large(moved, nsize, true);
+    return moved;
+}
+
+static void *block_alloc(size_t size) {
+    return size <= LUA_ALLOC_MAX_SMALL ? small_alloc(class_of(size)) : large_alloc(size);
+}
+
+static void block_free(void *block, size_t size) {
+    if (size <= LUA_ALLOC_MAX_SMALL) {
+        small_free(block);
+    } else {
+        count_large(block, size, false);
+        heap_caps_free(block);
+    }
+}
+
+static void *block_realloc(void *block, size_t osize, size_t nsize) {
+    bool was_small = osize <= LUA_ALLOC_MAX_SMALL;
+    bool is_small = nsize <= LUA_ALLOC_MAX_SMALL;
+
+    if (was_small && is_small && class_of(osize) == class_of(nsize)) {
+        return block;
+    }
+    if (!was_small && !is_small) {
+        return large_realloc(block, osize, nsize);
+    }
+
+    // Changes pool: copy into a new block first, so the old one survives a
+    // failure untouched
+    void *moved = block_alloc(nsize);
+    if (moved == NULL) return NULL;
+    memcpy(moved, block, osize < nsize ? osize : nsize);
+    block_free(block, osize);
+    return moved;
+}
+
+static void *lua_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void)ud;
+
+    // For a new block osize holds the type of object being created
+    if (ptr == NULL) osize = 0;
+
+    if (nsize == 0) {
+        if (ptr != NULL) {
+            block_free(ptr, osize);
+            s_stats.in_use -= osize;
+            s_stats.frees++;
+        }
+        return NULL;
+    }
+
+    if (nsize > osize && s_stats.budget != 0 &&
+        s_stats.in_use - osize + nsize > s_stats.budget) {
+        s_stats.limit_hits++;
+        s_stats.failures++;
+        return NULL;
+    }
+
+    void *block;
+    if (ptr == NULL) {
+        block = block_alloc(nsize);
+        s_stats.allocs++;
+    } else {
+        block = block_realloc(ptr, osize, nsize);
+        s_stats.reallocs++;
+    }
+    if (block == NULL) {
+        s_stats.failures++;
+        return NULL;
+    }
+
+    size_t before = s_stats.in_use;
+    s_stats.in_use = before - osize + nsize;
+    if (s_stats.in_use > s_stats.peak) {
+        s_stats.peak = s_stats.in_use;
+    }
+
+    // Collecting from inside the allocator is not allowed; have the hook
+    // do it once usage climbs past either mark
+    if ((before <= s_minor_gc_at && s_stats.in_use > s_minor_gc_at) ||
+        (before <= s_full_gc_at && s_stats.in_use > s_full_gc_at)) {
+        lua_signal(LUA_SIGNAL_GC);
+    }
+    return block;
+}
+
+lua_State *lua_alloc_newstate(void) {
+    if (!s_ready) alloc_init();
+    return lua_newstate(lua_alloc, NULL);
+}
+
+void lua_alloc_set_budget(size_t bytes) {
+    if (!s_ready) alloc_init();
+    set_budget(bytes ? bytes : s_default_budget);
+}
+
+void lua_alloc_relieve_pressure(lua_State *L) {
+    // The collector may have caught up on its own since the signal
+    if (s_stats.in_use <= s_minor_gc_at) return;
+
+    int64_t start = esp_timer_get_time();
+
+    // In generational mode a single step is a minor collection, which
+    // frees the young garbage a busy loop produces at little cost. Scripts
+    // drawing frames run the incremental collector, where it is one step.
+    lua_gc(L, LUA_GCSTEP, 0);
+    if (frame_gc_incremental()) {
+        s_stats.gc_steps++;
+    } else {
+        s_stats.minor_gcs++;
+    }
+
+    if (s_stats.in_use > s_full_gc_at) {
+        lua_gc(L, LUA_GCCOLLECT);
+        s_stats.full_gcs++;
+    }
+
+    uint32_t elapsed = (uint32_t)(esp_timer_get_time() - start);
+    s_stats.gc_total_us += elapsed;
+    if (elapsed > s_stats.gc_max_us) {
+        s_stats.gc_max_us = elapsed;
+    }
+}
+
+// Safe to call from any task; the numbers may be a few allocations apart
+void lua_alloc_get_stats(lua_alloc_stats_t *stats) {
+    *stats = s_stats;
+    stats->fragmentation = stats->slab_bytes == 0 ? 0 :
+        (uint8_t)((stats->slab_bytes - stats->slab_used) * 100 / stats->slab_bytes);
+}
+
+void lua_alloc_reset_stats(void) {
+    s_stats.peak = s_stats.in_use;
+    s_stats.allocs = 0;
+    s_stats.frees = 0;
+    s_stats.reallocs = 0;
+    s_stats.failures = 0;
+    s_stats.limit_hits = 0;
+    s_stats.reserve_hits = 0;
+    s_stats.minor_gcs = 0;
+    s_stats.gc_steps = 0;
+    s_stats.full_gcs = 0;
+    s_stats.gc_max_us = 0;
+    s_stats.gc_total_us = 0;
+}
+
+void lua_alloc_trim(void) {
+    for (unsigned cls = 0; cls < CLASS_COUNT; cls++) {
+        size_class_t *c = &s_classes[cls];
+        slab_t *slab = c->partial;
+        while (slab != NULL) {
+            slab_t *next = slab->next;
+            if (slab->used == 0) slab_release(c, slab);
+            slab = next;
+        }
+    }
+}
+
+void lua_alloc_log_stats(const char *message) {
+    lua_alloc_stats_t st;
+    lua_alloc_get_stats(&st);
+    ESP_LOGI(TAG, "In use: %u, peak: %u, budget: %u, slabs: %u (%u%% free), large: %u (%u in PSRAM), "
+        "allocs: %u, frees: %u, reallocs: %u, failures: %u (%u at limit, %u at reserve), "
+        "GC: %u minor, %u steps, %u full, max %u us, total %u us, %s",
+        (unsigned)st.in_use, (unsigned)st.peak, (unsigned)st.budget,
+        (unsigned)st.slabs, (unsigned)st.fragmentation,
+        (unsigned)st.large_bytes, (unsigned)st.psram_bytes,
+        (unsigned)st.allocs, (unsigned)st.frees, (unsigned)st.reallocs,
+        (unsigned)st.failures, (unsigned)st.limit_hits, (unsigned)st.reserve_hits,
+        (unsigned)st.minor_gcs, (unsigned)st.gc_steps, (unsigned)st.full_gcs,
+        (unsigned)st.gc_max_us, (unsigned)st.gc_total_us,
+        message);
+}
+
+int lua_set_mem_limit(lua_State *LUA) {
+    lua_Integer kb = luaL_optinteger(LUA, 1, 0);
+    luaL_argcheck(LUA, kb >= 0 && (lua_Unsigned)kb <= SIZE_MAX / 1024, 1, "limit out of range");
+    lua_alloc_set_budget((size_t)kb * 1024);
+
+    // A lower limit may already be past the collection thresholds
+    lua_alloc_relieve_pressure(LUA);
+    lua_pushinteger(LUA, (lua_Integer)(s_stats.budget / 1024));
+    return 1;
+}
+
+#define SET_FIELD(name, value) \
+    do { lua_pushinteger(LUA, (lua_Integer)(value)); lua_setfield(LUA, -2, name); } while (0)
+
+int lua_mem_stats(lua_State *LUA) {
+    lua_alloc_stats_t st;
+    lua_alloc_get_stats(&st);
+
+    lua_createtable(LUA, 0, 19);
+    SET_FIELD("in_use", st.in_use);
+    SET_FIELD("peak", st.peak);
+    SET_FIELD("budget", st.budget);
+    SET_FIELD("slabs", st.slabs);
+    SET_FIELD("slab_bytes", st.slab_bytes);
+    SET_FIELD("fragmentation", st.fragmentation);
+    SET_FIELD("large_bytes", st.large_bytes);
+    SET_FIELD("psram_bytes", st.psram_bytes);
+    SET_FIELD("allocs", st.allocs);
+    SET_FIELD("frees", st.frees);
+    SET_FIELD("reallocs", st.reallocs);
+    SET_FIELD("failures", st.failures);
+    SET_FIELD("limit_hits", st.limit_hits);
+    SET_FIELD("reserve_hits", st.reserve_hits);
+    SET_FIELD("minor_gcs", st.minor_gcs);
+    SET_FIELD("gc_steps", st.gc_steps);
+    SET_FIELD("full_gcs", st.full_gcs);
+    SET_FIELD("gc_max_us", st.gc_max_us);
+    SET_FIELD("gc_total_us", st.gc_total_us);
+    return 1;
+}
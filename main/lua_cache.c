@@ -0,0 +1,208 @@
+#include <lauxlib.h>
+#include <lualib.h>
+#include <lua.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "local_lua.h"
+#include "lua_cache.h"
+
+static const char* TAG = "lua_cache";
+
+#define CACHE_DIR LUA_FILE_PATH "/.luac"
+#define CACHE_MAGIC "LMC1"
+
+// Sidecar header, followed by the output of lua_dump()
+typedef struct {
+    char magic[4];
+    uint32_t size;
+    uint32_t mtime;
+    uint32_t hash;
+} cache_header_t;
+
+typedef struct {
+    FILE *fp;
+    char buf[512];
+} chunk_reader_t;
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// FNV-1a over the whole file. The parser is the expensive part of a load,
+// reading the source once more is cheap by comparison.
+static bool hash_file(const char *path, uint32_t *hash) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL) return false;
+
+    uint8_t buf[256];
+    uint32_t h = FNV_OFFSET;
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            h = (h ^ buf[i]) * FNV_PRIME;
+        }
+    }
+    fclose(fp);
+    *hash = h;
+    return true;
+}
+
+// LUA_FILE_PATH/foo/bar.lua -> LUA_FILE_PATH/.luac/foo_bar.luac
+static bool cache_path(const char *path, char *out, size_t len) {
+    const char *name = path;
+    if (strncmp(path, LUA_FILE_PATH "/", strlen(LUA_FILE_PATH "/")) == 0) {
+        name = path + strlen(LUA_FILE_PATH "/");
+    }
+    int n = snprintf(out, len, CACHE_DIR "/%sc", name);
+    if (n < 0 || (size_t)n >= len) return false;
+    for (char *p = out + strlen(CACHE_DIR "/"); *p; p++) {
+        if (*p == '/') *p = '_';
+    }
+    return true;
+}
+
+static const char *chunk_read(lua_State *L, void *ud, size_t *size) {
+    (void)L;
+    chunk_reader_t *reader = ud;
+    *size = fread(reader->buf, 1, sizeof(reader->buf), reader->fp);
+    return *size > 0 ? reader->buf : NULL;
+}
+
+static int chunk_write(lua_State *L, const void *p, size_t size, void *ud) {
+    (void)L;
+    return fwrite(p, 1, size, (FILE *)ud) == size ? 0 : 1;
+}
+
+// Loads the cached bytecode for path if it was built from the current
+// source. Leaves the stack untouched and returns false otherwise.
+static bool load_cached(lua_State *L, const char *path, const char *cpath,
+                        const struct stat *st) {
+    FILE *fp = fopen(cpath, "rb");
+    if (fp == NULL) return false;
+
+    cache_header_t header;
+    uint32_t hash;
+    if (fread(&header, sizeof(header), 1, fp) != 1 ||
+        memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+        header.size != (uint32_t)st->st_size ||
+        header.mtime != (uint32_t)st->st_mtime ||
+        !hash_file(path, &hash) || header.hash != hash) {
+        fclose(fp);
+        return false;
+    }
+
+    // Binary chunks carry their own source name, so the chunk name passed
+    // here only matters for error messages from lua_load() itself
+    chunk_reader_t reader = { .fp = fp };
+    lua_pushfstring(L, "@%s", path);
+    int status = lua_load(L, chunk_read, &reader, lua_tostring(L, -1), "b");
+    lua_remove(L, -2);
+    fclose(fp);
+
+    if (status != LUA_OK) {
+        // Stale format (e.g. after a Lua upgrade) or a damaged file
+        ESP_LOGW(TAG, "Ignoring %s: %s", cpath, lua_tostring(L, -1));
+        lua_pop(L, 1);
+        return false;
+    }
+    return true;
+}
+
+// Dumps the function on top of the stack next to its source. Failure only
+// costs the next load a parse, so errors are just logged.
+static void store_cached(lua_State *L, const char *path, const char *cpath,
+                         const struct stat *st) {
+    cache_header_t header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.size = st->st_size;
+    header.mtime = st->st_mtime;
+    if (!hash_file(path, &header.hash)) return;
+
+    mkdir(CACHE_DIR, 0755);
+
+    // Write under a temporary name so a reset never leaves half a file
+    char tmp[160];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", cpath);
+    FILE *fp = fopen(tmp, "wb");
+    if (fp == NULL) {
+        ESP_LOGW(TAG, "Can't create %s", tmp);
+        return;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1 &&
+              lua_dump(L, chunk_write, fp, 0) == 0;
+    ok = (fclose(fp) == 0) && ok;
+    if (ok) {
+        remove(cpath);
+        ok = rename(tmp, cpath) == 0;
+    }
+    if (!ok) {
+        ESP_LOGW(TAG, "Failed to write %s", cpath);
+        remove(tmp);
+    }
+}
+
+int lua_cache_loadfile(lua_State *L, const char *path) {
+    struct stat st;
+    char cpath[128];
+
+    if (stat(path, &st) != 0 || !cache_path(path, cpath, sizeof(cpath))) {
+        return luaL_loadfile(L, path);
+    }
+
+    int64_t start = esp_timer_get_time();
+    if (load_cached(L, path, cpath, &st)) {
+        ESP_LOGI(TAG, "%s loaded from bytecode in %d us", path,
+                 (int)(esp_timer_get_time() - start));
+        return LUA_OK;
+    }
+
+    int status = luaL_loadfile(L, path);
+    if (status == LUA_OK) {
+        ESP_LOGI(TAG, "%s compiled in %d us", path, (int)(esp_timer_get_time() - start));
+        store_cached(L, path, cpath, &st);
+    }
+    return status;
+}
+
+// package.searchers entry replacing the stock Lua file searcher: same
+// lookup through package.path, but loading goes through the cache
+static int cached_searcher(lua_State *L) {
+    const char *name = luaL_checkstring(L, 1);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_getfield(L, -1, LUA_LOADLIBNAME);
+    lua_getfield(L, -1, "searchpath");
+    lua_pushstring(L, name);
+    lua_getfield(L, -3, "path");
+    lua_call(L, 2, 2);
+
+    if (lua_isnil(L, -2)) {
+        // Not found; searchpath's message lists the files tried
+        return 1;
+    }
+
+    const char *filename = lua_tostring(L, -2);
+    if (lua_cache_loadfile(L, filename) != LUA_OK) {
+        return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s",
+                          name, filename, lua_tostring(L, -1));
+    }
+    // Loader and the file name that is passed on to it
+    lua_pushvalue(L, -3);
+    return 2;
+}
+
+void lua_cache_install_searcher(lua_State *L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_getfield(L, -1, LUA_LOADLIBNAME);
+    if (lua_getfield(L, -1, "searchers") == LUA_TTABLE) {
+        // Slot 1 is the preload searcher, slot 2 the Lua file searcher
+        lua_pushcfunction(L, cached_searcher);
+        lua_rawseti(L, -2, 2);
+    }
+    lua_pop(L, 3);
+}
@@ -0,0 +1,691 @@
+#include <lauxlib.h>
+#include <lua.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "lua_json.h"
+
+// json.null is the NULL light userdata, so it compares equal everywhere
+// without a registry lookup
+#define push_null(L) lua_pushlightuserdata(L, NULL)
+
+typedef struct {
+    lua_State *L;
+    const char *start;
+    const char *p;
+    const char *end;
+    int depth;
+    const char *error;
+    size_t error_pos;
+} json_parser_t;
+
+static bool parse_value(json_parser_t *J, bool push);
+
+static bool fail(json_parser_t *J, const char *message) {
+    if (J->error == NULL) {
+        J->error = message;
+        J->error_pos = J->p - J->start;
+    }
+    return false;
+}
+
+static void skip_ws(json_parser_t *J) {
+    while (J->p < J->end && (*J->p == ' ' || *J->p == '\t' || *J->p == '\n' || *J->p == '\r')) {
+        J->p++;
+    }
+}
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// ============================================================================
+// Decoding
+// ============================================================================
+
+static bool parse_hex4(json_parser_t *J, uint32_t *out) {
+    if (J->end - J->p < 4) return fail(J, "invalid \\u escape");
+    uint32_t value = 0;
+    for (int i = 0; i < 4; i++) {
+        char c = *J->p++;
+        value <<= 4;
+        if (c >= '0' && c <= '9') value |= c - '0';
+        else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+        else return fail(J, "invalid \\u escape");
+    }
+    *out = value;
+    return true;
+}
+
+static int utf8_encode(uint32_t cp, char *out) {
+    if (cp < 0x80) {
+        out[0] = cp;
+        return 1;
+    } else if (cp < 0x800) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+        return 2;
+    } else if (cp < 0x10000) {
+        out[0] = 0xE0 | (cp >> 12);
+        out[1] = 0x80 | ((cp >> 6) & 0x3F);
+        out[2] = 0x80 | (cp & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (cp >> 18);
+    out[1] = 0x80 | ((cp >> 12) & 0x3F);
+    out[2] = 0x80 | ((cp >> 6) & 0x3F);
+    out[3] = 0x80 | (cp & 0x3F);
+    return 4;
+}
+
+// Reads one escape sequence after the backslash into out
+static bool parse_escape(json_parser_t *J, char *out, int *len) {
+    if (J->p >= J->end) return fail(J, "unterminated string");
+    char c = *J->p++;
+    *len = 1;
+    switch (c) {
+        case '"': case '\\': case '/': out[0] = c; return true;
+        case 'b': out[0] = '\b'; return true;
+        case 'f': out[0] = '\f'; return true;
+        case 'n': out[0] = '\n'; return true;
+        case 'r': out[0] = '\r'; return true;
+        case 't': out[0] = '\t'; return true;
+        case 'u': break;
+        default: return fail(J, "invalid escape");
+    }
+
+    uint32_t cp;
+    if (!parse_hex4(J, &cp)) return false;
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        // High surrogate, must be followed by the low half
+        uint32_t low;
+        if (J->end - J->p < 2 || J->p[0] != '\\' || J->p[1] != 'u') {
+            return fail(J, "invalid surrogate pair");
+        }
+        J->p += 2;
+        if (!parse_hex4(J, &low)) return false;
+        if (low < 0xDC00 || low > 0xDFFF) return fail(J, "invalid surrogate pair");
+        cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+    } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+        return fail(J, "invalid surrogate pair");
+    }
+    *len = utf8_encode(cp, out);
+    return true;
+}
+
+// J->p is at the opening quote; leaves it past the closing one
+static bool parse_string(json_parser_t *J, bool push) {
+    const char *run = ++J->p;
+
+    // Most strings have no escapes and are pushed straight from the input
+    while (J->p < J->end && *J->p != '"' && *J->p != '\\') {
+        if ((uint8_t)*J->p < 0x20) return fail(J, "control character in string");
+        J->p++;
+    }
+    if (J->p >= J->end) return fail(J, "unterminated string");
+    if (*J->p == '"') {
+        if (push) lua_pushlstring(J->L, run, J->p - run);
+        J->p++;
+        return true;
+    }
+
+    luaL_Buffer b;
+    if (push) {
+        luaL_buffinit(J->L, &b);
+        luaL_addlstring(&b, run, J->p - run);
+    }
+    while (J->p < J->end && *J->p != '"') {
+        char c = *J->p;
+        if ((uint8_t)c < 0x20) return fail(J, "control character in string");
+        J->p++;
+        if (c == '\\') {
+            char utf8[4];
+            int len;
+            if (!parse_escape(J, utf8, &len)) return false;
+            if (push) luaL_addlstring(&b, utf8, len);
+        } else if (push) {
+            luaL_addchar(&b, c);
+        }
+    }
+    if (J->p >= J->end) return fail(J, "unterminated string");
+    J->p++;
+    if (push) luaL_pushresult(&b);
+    return true;
+}
+
+static bool parse_number(json_parser_t *J, bool push) {
+    const char *s = J->p;
+    bool is_float = false;
+
+    if (*J->p == '-') J->p++;
+    if (J->p >= J->end || !is_digit(*J->p)) return fail(J, "invalid number");
+    if (*J->p == '0') {
+        J->p++;
+    } else {
+        while (J->p < J->end && is_digit(*J->p)) J->p++;
+    }
+    if (J->p < J->end && *J->p == '.') {
+        J->p++;
+        if (J->p >= J->end || !is_digit(*J->p)) return fail(J, "invalid number");
+        while (J->p < J->end && is_digit(*J->p)) J->p++;
+        is_float = true;
+    }
+    if (J->p < J->end && (*J->p == 'e' || *J->p == 'E')) {
+        J->p++;
+        if (J->p < J->end && (*J->p == '+' || *J->p == '-')) J->p++;
+        if (J->p >= J->end || !is_digit(*J->p)) return fail(J, "invalid number");
+        while (J->p < J->end && is_digit(*J->p)) J->p++;
+        is_float = true;
+    }
+    if (!push) return true;
+
+    // The grammar is checked above, so Lua's own conversion is exact here.
+    // Integers too large for lua_Integer come back as floats.
+    char buf[64];
+    size_t len = J->p - s;
+    if (len < sizeof(buf)) {
+        memcpy(buf, s, len);
+        buf[len] = '\0';
+        lua_stringtonumber(J->L, buf);
+    } else {
+        lua_pushlstring(J->L, s, len);
+        lua_stringtonumber(J->L, lua_tostring(J->L, -1));
+        lua_remove(J->L, -2);
+    }
+    if (is_float && lua_isinteger(J->L, -1)) {
+        // e.g. "1e2", which Lua reads as a float already; keep it that way
+        lua_pushnumber(J->L, (lua_Number)lua_tointeger(J->L, -1));
+        lua_remove(J->L, -2);
+    }
+    return true;
+}
+
+static bool parse_literal(json_parser_t *J, const char *word, size_t len) {
+    if ((size_t)(J->end - J->p) < len || memcmp(J->p, word, len) != 0) {
+        return fail(J, "unexpected character");
+    }
+    J->p += len;
+    return true;
+}
+
+static bool parse_object(json_parser_t *J, bool push) {
+    J->p++;
+    if (push) lua_newtable(J->L);
+    skip_ws(J);
+    if (J->p < J->end && *J->p == '}') {
+        J->p++;
+        return true;
+    }
+    while (true) {
+        skip_ws(J);
+        if (J->p >= J->end || *J->p != '"') return fail(J, "expected string key");
+        if (!parse_string(J, push)) return false;
+        skip_ws(J);
+        if (J->p >= J->end || *J->p != ':') return fail(J, "expected ':'");
+        J->p++;
+        if (!parse_value(J, push)) return false;
+        if (push) lua_rawset(J->L, -3);
+
+        skip_ws(J);
+        if (J->p >= J->end) return fail(J, "unterminated object");
+        if (*J->p == '}') {
+            J->p++;
+            return true;
+        }
+        if (*J->p != ',') return fail(J, "expected ',' or '}'");
+        J->p++;
+    }
+}
+
+static bool parse_array(json_parser_t *J, bool push) {
+    J->p++;
+    if (push) lua_newtable(J->L);
+    skip_ws(J);
+    if (J->p < J->end && *J->p == ']') {
+        J->p++;
+        return true;
+    }
+    for (lua_Integer i = 1;; i++) {
+        if (!parse_value(J, push)) return false;
+        if (push) lua_rawseti(J->L, -2, i);
+
+        skip_ws(J);
+        if (J->p >= J->end) return fail(J, "unterminated array");
+        if (*J->p == ']') {
+            J->p++;
+            return true;
+        }
+        if (*J->p != ',') return fail(J, "expected ',' or ']'");
+        J->p++;
+    }
+}
+
+// Parses one value, pushing it if push is set and skipping it otherwise
+static bool parse_value(json_parser_t *J, bool push) {
+    if (J->depth >= JSON_MAX_DEPTH) return fail(J, "nesting too deep");
+    if (push && !lua_checkstack(J->L, 4)) return fail(J, "nesting too deep");
+
+    skip_ws(J);
+    if (J->p >= J->end) return fail(J, "unexpected end of input");
+
+    bool ok;
+    J->depth++;
+    switch (*J->p) {
+        case '{': ok = parse_object(J, push); break;
+        case '[': ok = parse_array(J, push); break;
+        case '"': ok = parse_string(J, push); break;
+        case 't':
+            ok = parse_literal(J, "true", 4);
+            if (ok && push) lua_pushboolean(J->L, 1);
+            break;
+        case 'f':
+            ok = parse_literal(J, "false", 5);
+            if (ok && push) lua_pushboolean(J->L, 0);
+            break;
+        case 'n':
+            ok = parse_literal(J, "null", 4);
+            if (ok && push) push_null(J->L);
+            break;
+        default:
+            ok = parse_number(J, push);
+            break;
+    }
+    J->depth--;
+    return ok;
+}
+
+// Pushes nil and the parser's error message
+static int push_error(lua_State *L, int top, json_parser_t *J) {
+    lua_settop(L, top);
+    lua_pushnil(L);
+    lua_pushfstring(L, "%s at byte %d", J->error, (int)J->error_pos + 1);
+    return 2;
+}
+
+static bool init_parser(lua_State *L, json_parser_t *J) {
+    size_t len;
+    const char *text = luaL_checklstring(L, 1, &len);
+    memset(J, 0, sizeof(*J));
+    J->L = L;
+    J->start = J->p = text;
+    J->end = text + len;
+    return true;
+}
+
+static int json_decode(lua_State *L) {
+    if (lua_isnoneornil(L, 1)) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "no input");
+        return 2;
+    }
+    json_parser_t J;
+    init_parser(L, &J);
+    int top = lua_gettop(L);
+
+    if (!parse_value(&J, true)) {
+        return push_error(L, top, &J);
+    }
+    skip_ws(&J);
+    if (J.p != J.end) {
+        fail(&J, "trailing characters");
+        return push_error(L, top, &J);
+    }
+    return 1;
+}
+
+// ============================================================================
+// Path queries
+// ============================================================================
+
+// Compares the key string at J->p with key and moves past it
+static bool key_matches(json_parser_t *J, const char *key, size_t key_len, bool *match) {
+    const char *raw = J->p + 1;
+    const char *q = raw;
+    while (q < J->end && *q != '"' && *q != '\\') q++;
+    if (q < J->end && *q == '"') {
+        // No escapes: compare in place
+        *match = (size_t)(q - raw) == key_len && memcmp(raw, key, key_len) == 0;
+        J->p = q + 1;
+        return true;
+    }
+
+    if (!parse_string(J, true)) return false;
+    size_t len;
+    const char *s = lua_tolstring(J->L, -1, &len);
+    *match = len == key_len && memcmp(s, key, key_len) == 0;
+    lua_pop(J->L, 1);
+    return true;
+}
+
+// Moves J->p to the value of member key. *found is false if the object
+// has no such member.
+static bool find_member(json_parser_t *J, const char *key, size_t key_len, bool *found) {
+    J->p++;
+    skip_ws(J);
+    if (J->p < J->end && *J->p == '}') {
+        *found = false;
+        return true;
+    }
+    while (true) {
+        skip_ws(J);
+        if (J->p >= J->end || *J->p != '"') return fail(J, "expected string key");
+        bool match;
+        if (!key_matches(J, key, key_len, &match)) return false;
+        skip_ws(J);
+        if (J->p >= J->end || *J->p != ':') return fail(J, "expected ':'");
+        J->p++;
+        if (match) {
+            *found = true;
+            return true;
+        }
+        if (!parse_value(J, false)) return false;
+
+        skip_ws(J);
+        if (J->p >= J->end) return fail(J, "unterminated object");
+        if (*J->p == '}') {
+            *found = false;
+            return true;
+        }
+        if (*J->p != ',') return fail(J, "expected ',' or '}'");
+        J->p++;
+    }
+}
+
+// Moves J->p to element index (1-based) of the array
+static bool find_element(json_parser_t *J, long index, bool *found) {
+    J->p++;
+    skip_ws(J);
+    if (J->p < J->end && *J->p == ']') {
+        *found = false;
+        return true;
+    }
+    for (long i = 1;; i++) {
+        if (i == index) {
+            *found = true;
+            return true;
+        }
+        if (!parse_value(J, false)) return false;
+
+        skip_ws(J);
+        if (J->p >= J->end) return fail(J, "unterminated array");
+        if (*J->p == ']') {
+            *found = false;
+            return true;
+        }
+        if (*J->p != ',') return fail(J, "expected ',' or ']'");
+        J->p++;
+    }
+}
+
+static long parse_index(const char *s, size_t len) {
+    if (len == 0 || len > 9) return 0;
+    long index = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (!is_digit(s[i])) return 0;
+        index = index * 10 + (s[i] - '0');
+    }
+    return index;
+}
+
+static int json_get(lua_State *L) {
+    if (lua_isnoneornil(L, 1)) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "no input");
+        return 2;
+    }
+    const char *path = luaL_checkstring(L, 2);
+    json_parser_t J;
+    init_parser(L, &J);
+    int top = lua_gettop(L);
+
+    while (true) {
+        while (*path == '.') path++;
+        if (*path == '\0') break;
+
+        // Next segment: "name" or "[n]"
+        const char *key;
+        size_t key_len;
+        if (*path == '[') {
+            key = path + 1;
+            key_len = strcspn(key, "]");
+            path = key + key_len + (key[key_len] == ']');
+        } else {
+            key = path;
+            key_len = strcspn(path, ".[");
+            path += key_len;
+        }
+
+        skip_ws(&J);
+        if (J.p >= J.end) {
+            fail(&J, "unexpected end of input");
+            return push_error(L, top, &J);
+        }
+        bool found = false;
+        bool ok = true;
+        if (*J.p == '{') {
+            ok = find_member(&J, key, key_len, &found);
+        } else if (*J.p == '[') {
+            long index = parse_index(key, key_len);
+            if (index > 0) ok = find_element(&J, index, &found);
+        }
+        if (!ok) return push_error(L, top, &J);
+        if (!found) {
+            lua_pushnil(L);
+            return 1;
+        }
+    }
+
+    if (!parse_value(&J, true)) {
+        return push_error(L, top, &J);
+    }
+    return 1;
+}
+
+// ============================================================================
+// Encoding
+// ============================================================================
+
+// Output buffer living in a userdata at a fixed stack slot, so a Lua error
+// halfway through leaves only garbage for the collector
+typedef struct {
+    lua_State *L;
+    int slot;
+    char *data;
+    size_t len;
+    size_t cap;
+} json_out_t;
+
+static void out_reserve(json_out_t *out, size_t n) {
+    if (out->len + n <= out->cap) return;
+    size_t cap = out->cap * 2;
+    while (cap < out->len + n) cap *= 2;
+    char *data = lua_newuserdatauv(out->L, cap, 0);
+    memcpy(data, out->data, out->len);
+    lua_replace(out->L, out->slot);
+    out->data = data;
+    out->cap = cap;
+}
+
+static void out_add(json_out_t *out, const char *s, size_t len) {
+    out_reserve(out, len);
+    memcpy(out->data + out->len, s, len);
+    out->len += len;
+}
+
+static void out_char(json_out_t *out, char c) {
+    out_reserve(out, 1);
+    out->data[out->len++] = c;
+}
+
+static void encode_string(json_out_t *out, const char *s, size_t len) {
+    static const char hex[] = "0123456789abcdef";
+    out_char(out, '"');
+    size_t run = 0;
+    for (size_t i = 0; i < len; i++) {
+        uint8_t c = s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+        out_add(out, s + run, i - run);
+        run = i + 1;
+        switch (c) {
+            case '"': out_add(out, "\\\"", 2); break;
+            case '\\': out_add(out, "\\\\", 2); break;
+            case '\n': out_add(out, "\\n", 2); break;
+            case '\r': out_add(out, "\\r", 2); break;
+            case '\t': out_add(out, "\\t", 2); break;
+            case '\b': out_add(out, "\\b", 2); break;
+            case '\f': out_add(out, "\\f", 2); break;
+            default: {
+                char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF] };
+                out_add(out, esc, sizeof(esc));
+                break;
+            }
+        }
+    }
+    out_add(out, s + run, len - run);
+    out_char(out, '"');
+}
+
+static void encode_number(json_out_t *out, int idx) {
+    lua_State *L = out->L;
+    char buf[32];
+    int len;
+    if (lua_isinteger(L, idx)) {
+        len = snprintf(buf, sizeof(buf), "%lld", (long long)lua_tointeger(L, idx));
+    } else {
+        lua_Number n = lua_tonumber(L, idx);
+        if (!isfinite(n)) {
+            luaL_error(L, "json.encode: cannot encode %s", isnan(n) ? "NaN" : "infinity");
+        }
+        len = snprintf(buf, sizeof(buf), "%.14g", (double)n);
+    }
+    out_add(out, buf, len);
+}
+
+// Length n of the table at idx if its keys are exactly 1..n, else 0
+static lua_Integer array_length(lua_State *L, int idx) {
+    lua_Integer n = (lua_Integer)lua_rawlen(L, idx);
+    if (n == 0) return 0;
+    lua_Integer count = 0;
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        lua_pop(L, 1);
+        if (!lua_isinteger(L, -1) || lua_tointeger(L, -1) < 1 || lua_tointeger(L, -1) > n) {
+            lua_pop(L, 1);
+            return 0;
+        }
+        count++;
+    }
+    return count == n ? n : 0;
+}
+
+static void encode_value(json_out_t *out, int idx, int depth);
+
+static void encode_table(json_out_t *out, int idx, int depth) {
+    lua_State *L = out->L;
+    if (depth >= JSON_MAX_DEPTH) {
+        luaL_error(L, "json.encode: nesting too deep (cycle?)");
+    }
+    luaL_checkstack(L, 4, "json.encode");
+
+    lua_Integer n = array_length(L, idx);
+    if (n > 0) {
+        out_char(out, '[');
+        for (lua_Integer i = 1; i <= n; i++) {
+            if (i > 1) out_char(out, ',');
+            lua_rawgeti(L, idx, i);
+            encode_value(out, lua_gettop(L), depth + 1);
+            lua_pop(L, 1);
+        }
+        out_char(out, ']');
+        return;
+    }
+
+    out_char(out, '{');
+    bool first = true;
+    lua_pushnil(L);
+    while (lua_next(L, idx) != 0) {
+        if (!first) out_char(out, ',');
+        first = false;
+
+        int type = lua_type(L, -2);
+        if (type == LUA_TSTRING) {
+            size_t len;
+            const char *key = lua_tolstring(L, -2, &len);
+            encode_string(out, key, len);
+        } else if (type == LUA_TNUMBER) {
+            // Converted on a copy, lua_next needs the original key
+            lua_pushvalue(L, -2);
+            size_t len;
+            const char *key = lua_tolstring(L, -1, &len);
+            encode_string(out, key, len);
+            lua_pop(L, 1);
+        } else {
+            luaL_error(L, "json.encode: cannot encode a %s key", luaL_typename(L, -2));
+        }
+        out_char(out, ':');
+        encode_value(out, lua_gettop(L), depth + 1);
+        lua_pop(L, 1);
+    }
+    out_char(out, '}');
+}
+
+static void encode_value(json_out_t *out, int idx, int depth) {
+    lua_State *L = out->L;
+    switch (lua_type(L, idx)) {
+        case LUA_TNIL:
+            out_add(out, "null", 4);
+            break;
+        case LUA_TBOOLEAN:
+            if (lua_toboolean(L, idx)) out_add(out, "true", 4);
+            else out_add(out, "false", 5);
+            break;
+        case LUA_TNUMBER:
+            encode_number(out, idx);
+            break;
+        case LUA_TSTRING: {
+            size_t len;
+            const char *s = lua_tolstring(L, idx, &len);
+            encode_string(out, s, len);
+            break;
+        }
+        case LUA_TTABLE:
+            encode_table(out, idx, depth);
+            break;
+        case LUA_TLIGHTUSERDATA:
+            if (lua_touserdata(L, idx) == NULL) {
+                out_add(out, "null", 4);
+                break;
+            }
+            // fall through
+        default:
+            luaL_error(L, "json.encode: cannot encode a %s", luaL_typename(L, idx));
+    }
+}
+
+static int json_encode(lua_State *L) {
+    luaL_checkany(L, 1);
+    lua_settop(L, 1);
+
+    json_out_t out = { .L = L, .slot = 2, .cap = 256 };
+    out.data = lua_newuserdatauv(L, out.cap, 0);
+    encode_value(&out, 1, 0);
+    lua_pushlstring(L, out.data, out.len);
+    return 1;
+}
+
+void lua_json_register(lua_State *L) {
+    static const luaL_Reg funcs[] = {
+        { "decode", json_decode },
+        { "encode", json_encode },
+        { "get", json_get },
+        { NULL, NULL },
+    };
+    luaL_newlib(L, funcs);
+    push_null(L);
+    lua_setfield(L, -2, "null");
+    lua_setglobal(L, "json");
+}
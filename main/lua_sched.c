@@ -0,0 +1,530 @@
+
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdbool.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "local_lua.h"
+#include "lua_sched.h"
+#include "luamatrix_mqtt.h"
+
+static const char* TAG = "lua_sched";
+
+// Same message size limit as mqtt_receive()
+#define SCHED_MQTT_DATA_LEN 512
+
+#define TICK_US ((int64_t)portTICK_PERIOD_MS * 1000)
+
+typedef enum {
+    TASK_FREE = 0,
+    TASK_READY,       // runs in the next pass
+    TASK_RUNNING,
+    TASK_SLEEPING,    // in the heap until wake_us
+    TASK_WAIT_MQTT,   // in the heap too if the wait has a timeout
+    TASK_WAIT_EVENT,  // woken by the next lua_sched_notify(); heap as above
+} task_state_t;
+
+typedef struct {
+    task_state_t state;
+    int id;
+    lua_State *thread;
+    int thread_ref;   // registry reference keeping the coroutine alive
+    int fn_ref;       // every(): the function to call, LUA_NOREF otherwise
+    int64_t wake_us;
+    int64_t due_us;   // every(): start time of the current run
+    int64_t period_us;
+    int heap_pos;     // index in s_heap, -1 when not in it
+    int nargs;        // values waiting on the thread's stack for the resume
+    bool cancelled;   // cancelled itself while running
+    char topic[MQTT_MAX_TOPIC_LEN];  // wait_mqtt() filter, empty for any
+} sched_task_t;
+
+// The main chunk waiting in wait_mqtt() (filter set) or for an event
+// (ready set)
+typedef struct {
+    const char *filter;
+    bool (*ready)(void *arg);
+    void *arg;
+    bool done;
+    char topic[MQTT_MAX_TOPIC_LEN];
+    char data[SCHED_MQTT_DATA_LEN];
+} main_wait_t;
+
+static sched_task_t s_tasks[LUA_SCHED_MAX_TASKS];
+static int s_heap[LUA_SCHED_MAX_TASKS];   // task indexes, earliest wake first
+static int s_heap_len;
+static int s_task_count;
+static int s_next_id = 1;
+static sched_task_t *s_current;           // task being resumed
+static SemaphoreHandle_t s_wake;
+
+void lua_sched_init(void) {
+    if (s_wake == NULL) {
+        s_wake = xSemaphoreCreateBinary();
+    }
+}
+
+void lua_sched_notify(void) {
+    if (s_wake != NULL) {
+        xSemaphoreGive(s_wake);
+    }
+}
+
+bool lua_sched_has_tasks(void) {
+    return s_task_count > 0;
+}
+
+// ============================================================================
+// Wake time heap
+// ============================================================================
+
+static inline int64_t heap_wake(int i) {
+    return s_tasks[s_heap[i]].wake_us;
+}
+
+static void heap_swap(int a, int b) {
+    int t = s_heap[a];
+    s_heap[a] = s_heap[b];
+    s_heap[b] = t;
+    s_tasks[s_heap[a]].heap_pos = a;
+    s_tasks[s_heap[b]].heap_pos = b;
+}
+
+static void heap_up(int i) {
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (heap_wake(parent) <= heap_wake(i)) break;
+        heap_swap(i, parent);
+        i = parent;
+    }
+}
+
+static void heap_down(int i) {
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < s_heap_len && heap_wake(left) < heap_wake(smallest)) smallest = left;
+        if (right < s_heap_len && heap_wake(right) < heap_wake(smallest)) smallest = right;
+        if (smallest == i) break;
+        heap_swap(i, smallest);
+        i = smallest;
+    }
+}
+
+static void heap_push(int t) {
+    s_heap[s_heap_len] = t;
+    s_tasks[t].heap_pos = s_heap_len;
+    heap_up(s_heap_len++);
+}
+
+static void heap_remove(int t) {
+    int i = s_tasks[t].heap_pos;
+    if (i < 0) return;
+    s_tasks[t].heap_pos = -1;
+    s_heap_len--;
+    if (i != s_heap_len) {
+        s_heap[i] = s_heap[s_heap_len];
+        s_tasks[s_heap[i]].heap_pos = i;
+        heap_up(i);
+        heap_down(i);
+    }
+}
+
+// ============================================================================
+// Tasks
+// ============================================================================
+
+static int task_new(lua_State *L) {
+    int t = 0;
+    while (t < LUA_SCHED_MAX_TASKS && s_tasks[t].state != TASK_FREE) t++;
+    if (t == LUA_SCHED_MAX_TASKS) {
+        return luaL_error(L, "too many tasks (at most %d)", LUA_SCHED_MAX_TASKS);
+    }
+
+    sched_task_t *task = &s_tasks[t];
+    memset(task, 0, sizeof(*task));
+    task->thread = lua_newthread(L);
+    task->thread_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+    task->fn_ref = LUA_NOREF;
+    task->heap_pos = -1;
+    task->id = s_next_id++;
+    task->state = TASK_RUNNING;
+    s_task_count++;
+    return t;
+}
+
+static void task_free(lua_State *L, int t) {
+    sched_task_t *task = &s_tasks[t];
+    heap_remove(t);
+    luaL_unref(L, LUA_REGISTRYINDEX, task->thread_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, task->fn_ref);
+    memset(task, 0, sizeof(*task));
+    s_task_count--;
+}
+
+static void make_ready(int t, int nargs) {
+    heap_remove(t);
+    s_tasks[t].state = TASK_READY;
+    s_tasks[t].nargs = nargs;
+}
+
+static void resume_task(lua_State *L, int t) {
+    sched_task_t *task = &s_tasks[t];
+    task->state = TASK_RUNNING;
+    s_current = task;
+    int nres;
+    int status = lua_resume(task->thread, L, task->nargs, &nres);
+    s_current = NULL;
+    task->nargs = 0;
+
+    if (status == LUA_YIELD) {
+        lua_pop(task->thread, nres);
+        if (task->cancelled) {
+            task_free(L, t);
+        } else if (task->state == TASK_RUNNING) {
+            // A plain coroutine.yield() just lets the other tasks run
+            make_ready(t, 0);
+        }
+        return;
+    }
+
+    if (status == LUA_OK) {
+        lua_settop(task->thread, 0);
+        if (task->fn_ref == LUA_NOREF || task->cancelled) {
+            task_free(L, t);
+            return;
+        }
+        // every(): fixed rate, but a late run is not followed by a burst
+        // of catch-up runs
+        int64_t now = esp_timer_get_time();
+        task->due_us += task->period_us;
+        if (task->due_us < now) task->due_us = now;
+        task->wake_us = task->due_us;
+        task->state = TASK_SLEEPING;
+        lua_rawgeti(task->thread, LUA_REGISTRYINDEX, task->fn_ref);
+        heap_push(t);
+        return;
+    }
+
+    // An error in a task ends the script like one in the main chunk
+    lua_xmove(task->thread, L, 1);
+    task_free(L, t);
+    lua_error(L);
+}
+
+// ============================================================================
+// Scheduler loop
+// ============================================================================
+
+// MQTT topic filter: '+' matches one level, a trailing '#' any number
+static bool topic_matches(const char *filter, const char *topic) {
+    if (filter == NULL || filter[0] == '\0') return true;
+    while (*filter) {
+        if (*filter == '#') return true;
+        if (*filter == '+') {
+            while (*topic && *topic != '/') topic++;
+            filter++;
+        } else if (*filter == '/' && filter[1] == '#' && *topic == '\0') {
+            return true;
+        } else {
+            if (*filter != *topic) return false;
+            filter++;
+            topic++;
+        }
+    }
+    return *topic == '\0';
+}
+
+static bool mqtt_waiting(const main_wait_t *mw) {
+    if (mw != NULL && mw->filter != NULL && !mw->done) return true;
+    for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+        if (s_tasks[t].state == TASK_WAIT_MQTT) return true;
+    }
+    return false;
+}
+
+static bool main_waits_for(const main_wait_t *mw, const char *topic) {
+    return mw != NULL && mw->filter != NULL && !mw->done && topic_matches(mw->filter, topic);
+}
+
+static bool waiter_matches(const char *topic, void *arg) {
+    if (main_waits_for(arg, topic)) return true;
+    for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+        if (s_tasks[t].state == TASK_WAIT_MQTT && topic_matches(s_tasks[t].topic, topic)) return true;
+    }
+    return false;
+}
+
+// Only messages someone waits for leave the MQTT queue; the rest stay
+// there in order for scripts polling mqtt_receive()
+static void dispatch_mqtt(main_wait_t *mw) {
+    char topic[MQTT_MAX_TOPIC_LEN];
+    char data[SCHED_MQTT_DATA_LEN];
+
+    while (mqtt_waiting(mw) &&
+           mqtt_take_message(waiter_matches, mw, topic, sizeof(topic), data, sizeof(data))) {
+        if (main_waits_for(mw, topic)) {
+            strcpy(mw->topic, topic);
+            strcpy(mw->data, data);
+            mw->done = true;
+        }
+        for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+            sched_task_t *task = &s_tasks[t];
+            if (task->state == TASK_WAIT_MQTT && topic_matches(task->topic, topic)) {
+                lua_checkstack(task->thread, 2);
+                lua_pushstring(task->thread, topic);
+                lua_pushstring(task->thread, data);
+                make_ready(t, 2);
+            }
+        }
+    }
+}
+
+static void wake_event_waiters(void) {
+    for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+        if (s_tasks[t].state == TASK_WAIT_EVENT) make_ready(t, 0);
+    }
+}
+
+// Runs tasks until until_us (esp_timer time, 0 for as long as there are
+// tasks) or until the main chunk's wait is satisfied
+static void sched_loop(lua_State *L, int64_t until_us, main_wait_t *mw) {
+    for (;;) {
+        lua_check_signals(L);
+        dispatch_mqtt(mw);
+
+        int64_t now = esp_timer_get_time();
+        while (s_heap_len > 0 && heap_wake(0) <= now) {
+            int t = s_heap[0];
+            if (s_tasks[t].state == TASK_WAIT_MQTT) {
+                // wait_mqtt() timed out
+                lua_pushnil(s_tasks[t].thread);
+                make_ready(t, 1);
+            } else {
+                make_ready(t, 0);
+            }
+        }
+
+        // Resume each task that is ready now once; tasks woken or spawned
+        // meanwhile wait for the next pass
+        int ready[LUA_SCHED_MAX_TASKS];
+        int count = 0;
+        for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+            if (s_tasks[t].state == TASK_READY) ready[count++] = t;
+        }
+        for (int i = 0; i < count; i++) {
+            if (s_tasks[ready[i]].state == TASK_READY) {
+                resume_task(L, ready[i]);
+            }
+        }
+
+        if (mw != NULL && mw->ready != NULL && mw->ready(mw->arg)) mw->done = true;
+        if (mw != NULL && mw->done) return;
+        if (until_us == 0 && mw == NULL && s_task_count == 0) return;
+
+        // Within a tick of the deadline counts as there; a wait that short
+        // would overshoot it
+        now = esp_timer_get_time();
+        if (until_us != 0 && until_us - now < TICK_US) return;
+
+        bool any_ready = false;
+        for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+            if (s_tasks[t].state == TASK_READY) any_ready = true;
+        }
+        if (any_ready) {
+            // Still pick up events without waiting
+            if (xSemaphoreTake(s_wake, 0) == pdTRUE) wake_event_waiters();
+            continue;
+        }
+
+        TickType_t ticks = portMAX_DELAY;
+        if (until_us != 0) {
+            ticks = (TickType_t)((until_us - now) / TICK_US);
+        }
+        if (s_heap_len > 0) {
+            // Rounded up so the task is due when the wait ends
+            TickType_t heap_ticks = (TickType_t)((heap_wake(0) - now + TICK_US - 1) / TICK_US);
+            if (heap_ticks < ticks) ticks = heap_ticks;
+        }
+        if (xSemaphoreTake(s_wake, ticks) == pdTRUE) {
+            wake_event_waiters();
+        }
+    }
+}
+
+static bool is_main_thread(lua_State *L) {
+    bool main = lua_pushthread(L);
+    lua_pop(L, 1);
+    return main;
+}
+
+static bool is_task_thread(lua_State *L) {
+    return s_current != NULL && s_current->thread == L && lua_isyieldable(L);
+}
+
+int lua_sched_wait_until(lua_State *L, int64_t wake_us, lua_KContext ctx, lua_KFunction k) {
+    if (is_task_thread(L)) {
+        s_current->state = TASK_SLEEPING;
+        s_current->wake_us = wake_us;
+        heap_push(s_current - s_tasks);
+        return lua_yieldk(L, 0, ctx, k);
+    }
+
+    if (is_main_thread(L)) {
+        sched_loop(L, wake_us, NULL);
+    } else {
+        // Inside a coroutine of the script's own there is no one to yield to
+        int64_t wait_us = wake_us - esp_timer_get_time();
+        if (wait_us >= TICK_US) {
+            vTaskDelay((TickType_t)(wait_us / TICK_US));
+        }
+    }
+    return k ? k(L, LUA_OK, ctx) : 0;
+}
+
+int lua_sched_wait_event(lua_State *L, int64_t wake_us, bool (*ready)(void *arg), void *arg,
+                         lua_KContext ctx, lua_KFunction k) {
+    if (is_task_thread(L)) {
+        s_current->state = TASK_WAIT_EVENT;
+        if (wake_us != 0) {
+            s_current->wake_us = wake_us;
+            heap_push(s_current - s_tasks);
+        }
+        return lua_yieldk(L, 0, ctx, k);
+    }
+
+    if (is_main_thread(L)) {
+        // sched_loop gives up within a tick of the deadline; the rest is
+        // slept off here so k runs once, with the event in or the deadline
+        // passed. Calling k early would just wait again, one C level deeper.
+        main_wait_t mw = { .ready = ready, .arg = arg };
+        for (;;) {
+            sched_loop(L, wake_us, &mw);
+            if (mw.done || ready(arg)) break;
+            if (wake_us != 0 && esp_timer_get_time() >= wake_us) break;
+            vTaskDelay(1);
+        }
+    } else {
+        while (!ready(arg) && (wake_us == 0 || esp_timer_get_time() < wake_us)) {
+            vTaskDelay(1);
+        }
+    }
+    return k(L, LUA_OK, ctx);
+}
+
+int lua_sched_run(lua_State *L) {
+    if (s_task_count > 0) {
+        ESP_LOGI(TAG, "Main chunk done, running %d tasks", s_task_count);
+        sched_loop(L, 0, NULL);
+    }
+    return 0;
+}
+
+void lua_sched_reset(lua_State *L) {
+    for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+        if (s_tasks[t].state != TASK_FREE) {
+            task_free(L, t);
+        }
+    }
+    s_heap_len = 0;
+    s_current = NULL;
+    s_next_id = 1;
+}
+
+// ============================================================================
+// Lua bindings
+// ============================================================================
+
+int lua_spawn(lua_State *LUA) {
+    luaL_checktype(LUA, 1, LUA_TFUNCTION);
+    int nargs = lua_gettop(LUA);
+    int t = task_new(LUA);
+    sched_task_t *task = &s_tasks[t];
+
+    // The function and its arguments become the thread's first resume
+    lua_xmove(LUA, task->thread, nargs);
+    make_ready(t, nargs - 1);
+    lua_pushinteger(LUA, task->id);
+    return 1;
+}
+
+int lua_sleep(lua_State *LUA) {
+    lua_Integer ms = luaL_checkinteger(LUA, 1);
+    return lua_sched_wait_until(LUA, esp_timer_get_time() + ms * 1000, 0, NULL);
+}
+
+int lua_every(lua_State *LUA) {
+    lua_Integer ms = luaL_checkinteger(LUA, 1);
+    luaL_checktype(LUA, 2, LUA_TFUNCTION);
+    luaL_argcheck(LUA, ms > 0, 1, "period must be positive");
+
+    int t = task_new(LUA);
+    sched_task_t *task = &s_tasks[t];
+    lua_pushvalue(LUA, 2);
+    task->fn_ref = luaL_ref(LUA, LUA_REGISTRYINDEX);
+    lua_pushvalue(LUA, 2);
+    lua_xmove(LUA, task->thread, 1);
+
+    task->period_us = ms * 1000;
+    task->due_us = esp_timer_get_time() + task->period_us;
+    task->wake_us = task->due_us;
+    task->state = TASK_SLEEPING;
+    heap_push(t);
+    lua_pushinteger(LUA, task->id);
+    return 1;
+}
+
+int lua_wait_mqtt(lua_State *LUA) {
+    const char *filter = luaL_optstring(LUA, 1, "");
+    lua_Integer timeout_ms = luaL_optinteger(LUA, 2, 0);
+    int64_t wake_us = timeout_ms > 0 ? esp_timer_get_time() + timeout_ms * 1000 : 0;
+
+    if (is_task_thread(LUA)) {
+        sched_task_t *task = s_current;
+        task->state = TASK_WAIT_MQTT;
+        strncpy(task->topic, filter, sizeof(task->topic) - 1);
+        if (wake_us != 0) {
+            task->wake_us = wake_us;
+            heap_push(task - s_tasks);
+        }
+        // Resumed with topic and message, or nil on timeout
+        return lua_yield(LUA, 0);
+    }
+
+    if (!is_main_thread(LUA)) {
+        return luaL_error(LUA, "wait_mqtt() must be called from a task or the main chunk");
+    }
+
+    main_wait_t mw = { .filter = filter, .done = false };
+    sched_loop(LUA, wake_us, &mw);
+    if (!mw.done) {
+        lua_pushnil(LUA);
+        return 1;
+    }
+    lua_pushstring(LUA, mw.topic);
+    lua_pushstring(LUA, mw.data);
+    return 2;
+}
+
+int lua_cancel(lua_State *LUA) {
+    lua_Integer id = luaL_checkinteger(LUA, 1);
+    for (int t = 0; t < LUA_SCHED_MAX_TASKS; t++) {
+        sched_task_t *task = &s_tasks[t];
+        if (task->state == TASK_FREE || task->id != id) continue;
+        if (task == s_current) {
+            // Still on the stack; freed once it yields or returns
+            task->cancelled = true;
+        } else {
+            task_free(LUA, t);
+        }
+        lua_pushboolean(LUA, 1);
+        return 1;
+    }
+    lua_pushboolean(LUA, 0);
+    return 1;
+}
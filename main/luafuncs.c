@@ -5,15 +5,20 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include "esp_log.h"
 #include "esp_timer.h"
-#include "esp_http_client.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "display.h"
+#include "font.h"
+#include "frame_gc.h"
+#include "http_fetch.h"
+#include "lua_alloc.h"
+#include "lua_json.h"
+#include "lua_sched.h"
+#include "luafuncs.h"
 #include "luamatrix_mqtt.h"
-
-static const char* TAG = "luafuncs";
+#include "raster.h"
+#include "render_bench.h"
 
 #define LOCAL_LUA_INTEGER 1
 #define LOCAL_LUA_NUMBER 2
@@ -136,26 +141,56 @@ int lua_clear_display(lua_State *LUA) {
     return 0;
 }
 
-// Bresenham's line algorithm
-static void draw_line_impl(int x0, int y0, int x1, int y1, int r, int g, int b) {
-    int dx = abs(x1 - x0);
-    int dy = -abs(y1 - y0);
-    int sx = x0 < x1 ? 1 : -1;
-    int sy = y0 < y1 ? 1 : -1;
-    int err = dx + dy;
-
-    while (1) {
-        set_pixel(x0, y0, r, g, b);
-        if (x0 == x1 && y0 == y1) break;
-        int e2 = 2 * err;
-        if (e2 >= dy) {
-            err += dy;
-            x0 += sx;
-        }
-        if (e2 <= dx) {
-            err += dx;
-            y0 += sy;
-        }
+// begin_frame() - start drawing a frame into the hidden back buffer.
+// The back buffer starts out cleared, so nothing needs erasing. Returns
+// false if there was no memory for the back buffer and frames are drawn
+// straight to the panel.
+int lua_begin_frame(lua_State *LUA) {
+    frame_gc_begin(LUA);
+    lua_pushboolean(LUA, display_begin_frame());
+    return 1;
+}
+
+static int present_k(lua_State *LUA, int status, lua_KContext ctx) {
+    (void)status;
+    (void)ctx;
+    frame_gc_run(LUA);
+    display_present();
+    return 0;
+}
+
+// present() - show the frame drawn since begin_frame(), paced to the
+// target frame rate. The wait for the frame slot goes to the other tasks,
+// then to the collector.
+int lua_present(lua_State *LUA) {
+    int64_t deadline = display_frame_deadline();
+    if (deadline != 0 && lua_sched_has_tasks()) {
+        return lua_sched_wait_until(LUA, deadline, 0, present_k);
+    }
+    return present_k(LUA, LUA_OK, 0);
+}
+
+// set_target_fps(fps) - frame rate present() paces to, 0 = as fast as possible
+int lua_set_target_fps(lua_State *LUA) {
+    int fps;
+    LUA_ARG(LUA, 1, LOCAL_LUA_INTEGER, fps, "set_target_fps");
+    display_set_target_fps(fps);
+    return 0;
+}
+
+// set_antialias(on): smooth lines, circles and coverage fonts
+int lua_set_antialias(lua_State *LUA) {
+    raster_set_antialias(lua_toboolean(LUA, 1));
+    return 0;
+}
+
+// Bresenham's line algorithm, clipped and drawn as spans, or Wu's
+// algorithm when anti-aliasing is on
+void draw_line(int x0, int y0, int x1, int y1, int r, int g, int b) {
+    if (raster_antialias()) {
+        raster_line_aa(x0, y0, x1, y1, r, g, b);
+    } else {
+        raster_line(x0, y0, x1, y1, r, g, b);
     }
 }
 
@@ -168,11 +203,19 @@ int lua_draw_line(lua_State *LUA) {
     LUA_ARG(LUA, 5, LOCAL_LUA_INTEGER, r, "draw_line");
     LUA_ARG(LUA, 6, LOCAL_LUA_INTEGER, g, "draw_line");
     LUA_ARG(LUA, 7, LOCAL_LUA_INTEGER, b, "draw_line");
-    draw_line_impl(x0, y0, x1, y1, r, g, b);
+    draw_line(x0, y0, x1, y1, r, g, b);
     return 0;
 }
 
-// Midpoint circle algorithm
+// Midpoint circle algorithm, or a Wu-style circle when anti-aliasing is on
+void draw_circle(int cx, int cy, int radius, int r, int g, int b) {
+    if (raster_antialias()) {
+        raster_circle_aa(cx, cy, radius, r, g, b);
+    } else {
+        raster_circle(cx, cy, radius, r, g, b);
+    }
+}
+
 int lua_draw_circle(lua_State *LUA) {
     int cx, cy, radius, r, g, b;
     LUA_ARG(LUA, 1, LOCAL_LUA_INTEGER, cx, "draw_circle");
@@ -181,33 +224,15 @@ int lua_draw_circle(lua_State *LUA) {
     LUA_ARG(LUA, 4, LOCAL_LUA_INTEGER, r, "draw_circle");
     LUA_ARG(LUA, 5, LOCAL_LUA_INTEGER, g, "draw_circle");
     LUA_ARG(LUA, 6, LOCAL_LUA_INTEGER, b, "draw_circle");
-
-    int x = radius;
-    int y = 0;
-    int d = 1 - radius;
-
-    while (x >= y) {
-        set_pixel(cx + x, cy + y, r, g, b);
-        set_pixel(cx - x, cy + y, r, g, b);
-        set_pixel(cx + x, cy - y, r, g, b);
-        set_pixel(cx - x, cy - y, r, g, b);
-        set_pixel(cx + y, cy + x, r, g, b);
-        set_pixel(cx - y, cy + x, r, g, b);
-        set_pixel(cx + y, cy - x, r, g, b);
-        set_pixel(cx - y, cy - x, r, g, b);
-
-        y++;
-        if (d < 0) {
-            d += 2 * y + 1;
-        } else {
-            x--;
-            d += 2 * (y - x) + 1;
-        }
-    }
+    draw_circle(cx, cy, radius, r, g, b);
     return 0;
 }
 
-// Filled circle using horizontal lines
+// Filled circle using one horizontal span per row
+void draw_filled_circle(int cx, int cy, int radius, int r, int g, int b) {
+    raster_filled_circle(cx, cy, radius, r, g, b);
+}
+
 int lua_draw_filled_circle(lua_State *LUA) {
     int cx, cy, radius, r, g, b;
     LUA_ARG(LUA, 1, LOCAL_LUA_INTEGER, cx, "draw_filled_circle");
@@ -216,29 +241,17 @@ int lua_draw_filled_circle(lua_State *LUA) {
     LUA_ARG(LUA, 4, LOCAL_LUA_INTEGER, r, "draw_filled_circle");
     LUA_ARG(LUA, 5, LOCAL_LUA_INTEGER, g, "draw_filled_circle");
     LUA_ARG(LUA, 6, LOCAL_LUA_INTEGER, b, "draw_filled_circle");
-
-    int x = radius;
-    int y = 0;
-    int d = 1 - radius;
-
-    while (x >= y) {
-        horiz_line(cx - x, cy + y, 2 * x + 1, r, g, b);
-        horiz_line(cx - x, cy - y, 2 * x + 1, r, g, b);
-        horiz_line(cx - y, cy + x, 2 * y + 1, r, g, b);
-        horiz_line(cx - y, cy - x, 2 * y + 1, r, g, b);
-
-        y++;
-        if (d < 0) {
-            d += 2 * y + 1;
-        } else {
-            x--;
-            d += 2 * (y - x) + 1;
-        }
-    }
+    draw_filled_circle(cx, cy, radius, r, g, b);
     return 0;
 }
 
 // Triangle outline using three lines
+void draw_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int r, int g, int b) {
+    draw_line(x0, y0, x1, y1, r, g, b);
+    draw_line(x1, y1, x2, y2, r, g, b);
+    draw_line(x2, y2, x0, y0, r, g, b);
+}
+
 int lua_draw_triangle(lua_State *LUA) {
     int x0, y0, x1, y1, x2, y2, r, g, b;
     LUA_ARG(LUA, 1, LOCAL_LUA_INTEGER, x0, "draw_triangle");
@@ -250,15 +263,13 @@ int lua_draw_triangle(lua_State *LUA) {
     LUA_ARG(LUA, 7, LOCAL_LUA_INTEGER, r, "draw_triangle");
     LUA_ARG(LUA, 8, LOCAL_LUA_INTEGER, g, "draw_triangle");
     LUA_ARG(LUA, 9, LOCAL_LUA_INTEGER, b, "draw_triangle");
-    draw_line_impl(x0, y0, x1, y1, r, g, b);
-    draw_line_impl(x1, y1, x2, y2, r, g, b);
-    draw_line_impl(x2, y2, x0, y0, r, g, b);
+    draw_triangle(x0, y0, x1, y1, x2, y2, r, g, b);
     return 0;
 }
 
 // Filled triangle using scanline algorithm
-static void swap_int(int *a, int *b) {
-    int t = *a; *a = *b; *b = t;
+void draw_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int r, int g, int b) {
+    raster_filled_triangle(x0, y0, x1, y1, x2, y2, r, g, b);
 }
 
 int lua_draw_filled_triangle(lua_State *LUA) {
@@ -272,41 +283,7 @@ int lua_draw_filled_triangle(lua_State *LUA) {
     LUA_ARG(LUA, 7, LOCAL_LUA_INTEGER, r, "draw_filled_triangle");
     LUA_ARG(LUA, 8, LOCAL_LUA_INTEGER, g, "draw_filled_triangle");
     LUA_ARG(LUA, 9, LOCAL_LUA_INTEGER, b, "draw_filled_triangle");
-
-    // Sort vertices by y-coordinate (y0 <= y1 <= y2)
-    if (y0 > y1) { swap_int(&y0, &y1); swap_int(&x0, &x1); }
-    if (y1 > y2) { swap_int(&y1, &y2); swap_int(&x1, &x2); }
-    if (y0 > y1) { swap_int(&y0, &y1); swap_int(&x0, &x1); }
-
-    if (y0 == y2) {
-        // Degenerate case - horizontal line
-        int minx = x0 < x1 ? (x0 < x2 ? x0 : x2) : (x1 < x2 ? x1 : x2);
-        int maxx = x0 > x1 ? (x0 > x2 ? x0 : x2) : (x1 > x2 ? x1 : x2);
-        horiz_line(minx, y0, maxx - minx + 1, r, g, b);
-        return 0;
-    }
-
-    // Fill using horizontal lines
-    for (int y = y0; y <= y2; y++) {
-        int xa, xb;
-
-        if (y < y1) {
-            // Upper part of triangle
-            xa = x0 + (x1 - x0) * (y - y0) / (y1 - y0);
-            xb = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
-        } else {
-            // Lower part of triangle
-            if (y1 == y2) {
-                xa = x1;
-            } else {
-                xa = x1 + (x2 - x1) * (y - y1) / (y2 - y1);
-            }
-            xb = x0 + (x2 - x0) * (y - y0) / (y2 - y0);
-        }
-
-        if (xa > xb) swap_int(&xa, &xb);
-        horiz_line(xa, y, xb - xa + 1, r, g, b);
-    }
+    draw_filled_triangle(x0, y0, x1, y1, x2, y2, r, g, b);
     return 0;
 }
 
@@ -711,46 +688,41 @@ static void draw_char_sized(int x, int y, char c, int r, int g, int b, int size)
     int idx = c - 32;
 
     if (size == 3) {
-        const uint8_t *glyph = font3x3[idx];
-        for (int row = 0; row < 3; row++) {
-            uint8_t bits = glyph[row];
-            for (int col = 0; col < 3; col++) {
-                if (bits & (1 << col)) {
-                    set_pixel(x + col, y + row, r, g, b);
-                }
-            }
-        }
+        raster_glyph(x, y, font3x3[idx], 1, 3, 3, r, g, b);
     } else if (size == 5) {
-        const uint8_t *glyph = font5x5[idx];
-        for (int row = 0; row < 5; row++) {
-            uint8_t bits = glyph[row];
-            for (int col = 0; col < 5; col++) {
-                if (bits & (1 << col)) {
-                    set_pixel(x + col, y + row, r, g, b);
-                }
-            }
-        }
+        raster_glyph(x, y, font5x5[idx], 1, 5, 5, r, g, b);
     } else if (size == 16) {
-        const uint16_t *glyph = font16x16[idx];
-        for (int row = 0; row < 16; row++) {
-            uint16_t bits = glyph[row];
-            for (int col = 0; col < 16; col++) {
-                if (bits & (1 << col)) {
-                    set_pixel(x + col, y + row, r, g, b);
-                }
-            }
-        }
+        raster_glyph(x, y, font16x16[idx], 2, 16, 16, r, g, b);
     } else {
         // Default to 8x8
-        const uint8_t *glyph = font8x8[idx];
-        for (int row = 0; row < 8; row++) {
-            uint8_t bits = glyph[row];
-            for (int col = 0; col < 8; col++) {
-                if (bits & (1 << col)) {
-                    set_pixel(x + col, y + row, r, g, b);
-                }
-            }
-        }
+        raster_glyph(x, y, font8x8[idx], 1, 8, 8, r, g, b);
+    }
+}
+
+// Draws a string of fixed-size glyphs, skipping whatever is off-screen.
+// Long scrolling tickers are mostly off-screen, so the characters left of
+// the panel are stepped over arithmetically and drawing stops at the
+// right edge.
+static void draw_string_sized(const char *str, int x, int y, int r, int g, int b, int size) {
+    if (y >= get_height() || y + size <= 0) return;
+
+    // Add 1 pixel spacing between characters
+    int char_width = (size == 3) ? 4 : (size == 5) ? 6 : (size == 16) ? 17 : 9;
+    size_t len = strlen(str);
+    int64_t cursor_x = x;
+
+    if (cursor_x + size <= 0) {
+        int64_t skip = (-cursor_x - size) / char_width + 1;
+        if ((uint64_t)skip >= len) return;
+        str += skip;
+        len -= skip;
+        cursor_x += skip * char_width;
+    }
+
+    int width = get_width();
+    for (size_t i = 0; i < len && cursor_x < width; i++) {
+        draw_char_sized((int)cursor_x, y, str[i], r, g, b, size);
+        cursor_x += char_width;
     }
 }
 
@@ -769,6 +741,17 @@ int lua_draw_string(lua_State *LUA) {
     LUA_ARG(LUA, 5, LOCAL_LUA_INTEGER, g, "draw_string");
     LUA_ARG(LUA, 6, LOCAL_LUA_INTEGER, b, "draw_string");
 
+    // Optional font: a file in the assets directory, or a built-in size
+    if (nargs >= 7 && lua_type(LUA, 7) == LUA_TSTRING) {
+        const char *name = lua_tostring(LUA, 7);
+        font_t *font = font_get(name);
+        if (font == NULL) {
+            return luaL_error(LUA, "draw_string: can't load font '%s'", name);
+        }
+        font_draw_string(font, str, x, y, r, g, b);
+        return 0;
+    }
+
     // Optional font size parameter (default 8)
     if (nargs >= 7 && lua_isinteger(LUA, 7)) {
         size = lua_tointeger(LUA, 7);
@@ -778,17 +761,34 @@ int lua_draw_string(lua_State *LUA) {
         }
     }
 
-    int cursor_x = x;
-    // Add 1 pixel spacing between characters
-    int char_width = (size == 3) ? 4 : (size == 5) ? 6 : (size == 16) ? 17 : 9;
-    while (*str) {
-        draw_char_sized(cursor_x, y, *str, r, g, b, size);
-        cursor_x += char_width;
-        str++;
-    }
+    draw_string_sized(str, x, y, r, g, b, size);
     return 0;
 }
 
+// Width in pixels that draw_string() advances for str in the given font
+int lua_text_width(lua_State *LUA) {
+    const char *str;
+    int size = 8;
+    LUA_ARG(LUA, 1, LOCAL_LUA_STRING, str, "text_width");
+
+    if (lua_type(LUA, 2) == LUA_TSTRING) {
+        const char *name = lua_tostring(LUA, 2);
+        font_t *font = font_get(name);
+        if (font == NULL) {
+            return luaL_error(LUA, "text_width: can't load font '%s'", name);
+        }
+        lua_pushinteger(LUA, font_text_width(font, str));
+        return 1;
+    }
+
+    if (lua_isinteger(LUA, 2)) {
+        size = lua_tointeger(LUA, 2);
+    }
+    int char_width = (size == 3) ? 4 : (size == 5) ? 6 : (size == 16) ? 17 : 9;
+    lua_pushinteger(LUA, (lua_Integer)strlen(str) * char_width);
+    return 1;
+}
+
 // C-callable text drawing function for boot screen etc.
 void draw_text(const char *str, int x, int y, int r, int g, int b, int size) {
     // Validate size
@@ -796,13 +796,7 @@ void draw_text(const char *str, int x, int y, int r, int g, int b, int size) {
         size = 8;
     }
 
-    int cursor_x = x;
-    int char_width = (size == 3) ? 4 : (size == 5) ? 6 : (size == 16) ? 17 : 9;
-    while (*str) {
-        draw_char_sized(cursor_x, y, *str, r, g, b, size);
-        cursor_x += char_width;
-        str++;
-    }
+    draw_string_sized(str, x, y, r, g, b, size);
 }
 
 int lua_millis(lua_State *LUA) {
@@ -812,9 +806,14 @@ int lua_millis(lua_State *LUA) {
     return 1;
 }
 
+// delay(ms) - same as sleep(ms) once the script has tasks, so a task
+// calling it doesn't stall the others
 int lua_delay(lua_State *LUA) {
     int ms;
     LUA_ARG(LUA, 1, LOCAL_LUA_INTEGER, ms, "delay");
+    if (lua_sched_has_tasks()) {
+        return lua_sched_wait_until(LUA, esp_timer_get_time() + (int64_t)ms * 1000, 0, NULL);
+    }
     if (ms > 0) {
         vTaskDelay(pdMS_TO_TICKS(ms));
     }
@@ -878,99 +877,14 @@ int lua_mqtt_wait(lua_State *LUA) {
     return 1;
 }
 
-// http_fetch(url) - fetch content from HTTP server
-// url format: "hostname:port/path" or "hostname/path" or "hostname:port" or "hostname"
-// Returns: response body as string, or nil on error
-#define HTTP_FETCH_MAX_SIZE 8192
-
-int lua_http_fetch(lua_State *LUA) {
-    if (lua_gettop(LUA) < 1 || !lua_isstring(LUA, 1)) {
-        lua_pushliteral(LUA, "http_fetch requires a URL string");
-        lua_error(LUA);
-        return 0;
-    }
-
-    const char *url_arg = lua_tostring(LUA, 1);
-
-    // Build the full URL with http:// prefix if needed
-    char url[512];
-    if (strncmp(url_arg, "http://", 7) == 0 || strncmp(url_arg, "https://", 8) == 0) {
-        snprintf(url, sizeof(url), "%s", url_arg);
-    } else {
-        snprintf(url, sizeof(url), "http://%s", url_arg);
-    }
-
-    ESP_LOGI(TAG, "http_fetch: %s", url);
-
-    esp_http_client_config_t config = {
-        .url = url,
-        .timeout_ms = 10000,
-    };
-
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    if (client == NULL) {
-        ESP_LOGE(TAG, "Failed to init HTTP client");
-        lua_pushnil(LUA);
-        return 1;
-    }
-
-    esp_err_t err = esp_http_client_open(client, 0);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to open HTTP connection: %s", esp_err_to_name(err));
-        esp_http_client_cleanup(client);
-        lua_pushnil(LUA);
-        return 1;
-    }
-
-    int content_length = esp_http_client_fetch_headers(client);
-    if (content_length < 0) {
-        content_length = HTTP_FETCH_MAX_SIZE; // Unknown length, try to read up to max
-    }
-
-    // Limit to max size
-    if (content_length > HTTP_FETCH_MAX_SIZE) {
-        content_length = HTTP_FETCH_MAX_SIZE;
-    }
-
-    char *buffer = malloc(content_length + 1);
-    if (buffer == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate buffer for HTTP response");
-        esp_http_client_close(client);
-        esp_http_client_cleanup(client);
-        lua_pushnil(LUA);
-        return 1;
-    }
-
-    int total_read = 0;
-    int read_len;
-    while (total_read < content_length) {
-        read_len = esp_http_client_read(client, buffer + total_read, content_length - total_read);
-        if (read_len <= 0) {
-            break;
-        }
-        total_read += read_len;
-    }
-    buffer[total_read] = '\0';
-
-    int status = esp_http_client_get_status_code(client);
-    ESP_LOGI(TAG, "HTTP status: %d, read %d bytes", status, total_read);
-
-    esp_http_client_close(client);
-    esp_http_client_cleanup(client);
-
-    if (status >= 200 && status < 300) {
-        lua_pushstring(LUA, buffer);
-    } else {
-        ESP_LOGE(TAG, "HTTP request failed with status %d", status);
-        lua_pushnil(LUA);
-    }
-
-    free(buffer);
-    return 1;
-}
-
 void load_lua_funcs(lua_State *LUA) {
     lua_register(LUA, "clear_display", lua_clear_display);
+    lua_register(LUA, "begin_frame", lua_begin_frame);
+    lua_register(LUA, "present", lua_present);
+    lua_register(LUA, "set_target_fps", lua_set_target_fps);
+    lua_register(LUA, "set_frame_gc", lua_set_frame_gc);
+    lua_register(LUA, "frame_stats", lua_frame_stats);
+    lua_register(LUA, "set_antialias", lua_set_antialias);
     lua_register(LUA, "fill_rect", lua_fill_rect);
     lua_register(LUA, "draw_hline", lua_draw_hline);
     lua_register(LUA, "draw_vline", lua_draw_vline);
@@ -981,11 +895,23 @@ void load_lua_funcs(lua_State *LUA) {
     lua_register(LUA, "draw_triangle", lua_draw_triangle);
     lua_register(LUA, "draw_filled_triangle", lua_draw_filled_triangle);
     lua_register(LUA, "draw_string", lua_draw_string);
+    lua_register(LUA, "text_width", lua_text_width);
     lua_register(LUA, "millis", lua_millis);
     lua_register(LUA, "delay", lua_delay);
+    lua_register(LUA, "spawn", lua_spawn);
+    lua_register(LUA, "sleep", lua_sleep);
+    lua_register(LUA, "every", lua_every);
+    lua_register(LUA, "wait_mqtt", lua_wait_mqtt);
+    lua_register(LUA, "cancel", lua_cancel);
     lua_register(LUA, "mqtt_connected", lua_mqtt_connected);
     lua_register(LUA, "mqtt_publish", lua_mqtt_publish);
     lua_register(LUA, "mqtt_receive", lua_mqtt_receive);
     lua_register(LUA, "mqtt_wait", lua_mqtt_wait);
     lua_register(LUA, "http_fetch", lua_http_fetch);
+    lua_register(LUA, "http_fetch_async", lua_http_fetch_async);
+    lua_register(LUA, "http_stream", lua_http_stream);
+    lua_register(LUA, "render_bench", lua_render_bench);
+    lua_register(LUA, "mem_stats", lua_mem_stats);
+    lua_register(LUA, "set_mem_limit", lua_set_mem_limit);
+    lua_json_register(LUA);
 }
\ No newline at end of file
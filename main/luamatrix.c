@@ -16,6 +16,7 @@
 #include "captive_portal.h"
 #include "display.h"
 #include "local_lua.h"
+#include "task_topology.h"
 #include "luafuncs.h"
 #include "luamatrix_mqtt.h"
 
@@ -84,6 +85,15 @@ void wifi_event_cb(wifi_config_event_t event)
     }
 }
 
+// Runs display.lua for good, restarting it whenever it ends
+static void lua_task(void *arg) {
+    (void)arg;
+    while (1) {
+        run_lua_file("display.lua");
+        vTaskDelay(pdMS_TO_TICKS(1000));
+    }
+}
+
 void app_main(void)
 {
     // Init the LED matrix panel
@@ -157,9 +167,7 @@ void app_main(void)
     boot_show_status("Ready!");
     vTaskDelay(pdMS_TO_TICKS(1000));
 
-    // Prevent the task from ending
-    while (1) {
-        run_lua_file("display.lua");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-    }
+    // app_main's own task is freed when it returns
+    xTaskCreatePinnedToCore(lua_task, "lua", LUA_TASK_STACK, NULL, LUA_TASK_PRIORITY, NULL,
+                            LUA_TASK_CORE);
 }
\ No newline at end of file
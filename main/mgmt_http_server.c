@@ -27,7 +27,11 @@
 #include "esp_log.h"
 #include "esp_vfs.h"
 #include "local_lua.h"
+#include "edit_html_tpl.h"
+#include "task_topology.h"
 #include "luamatrix_mqtt.h"
+#include "multipart.h"
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -42,13 +46,12 @@
 #define TEMPLATE(name)     _binary_##name##_start
 #define TEMPLATE_LEN(name) (_binary_##name##_end - _binary_##name##_start)
 
-DECLARE_TEMPLATE(favicon_svg);
-DECLARE_TEMPLATE(mgmt_index_html);
+DECLARE_TEMPLATE(favicon_svg_gz);
+DECLARE_TEMPLATE(mgmt_index_html_gz);
 DECLARE_TEMPLATE(logout_html);
-DECLARE_TEMPLATE(edit_html);
 DECLARE_TEMPLATE(firmware_html);
 DECLARE_TEMPLATE(reboot_html);
-#define UPLOAD_BUF_SIZE 1024
+#define UPLOAD_BUF_SIZE 4096
 
 static const char* TAG = "http";
 
@@ -82,16 +85,51 @@ static void url_decode(char *str) {
 
 static httpd_handle_t server = NULL;
 
+// Static page gzipped at build time (tools/gzip_asset.py). The ETag is a
+// hash of the embedded bytes, so it changes only when the page does.
+typedef struct {
+        const char *start;
+        const char *end;
+        const char *type;
+        char etag[12];
+} gz_asset_t;
+
+#define GZ_ASSET(name, mime) { _binary_##name##_start, _binary_##name##_end, mime, "" }
+
+static gz_asset_t index_asset = GZ_ASSET(mgmt_index_html_gz, "text/html");
+static gz_asset_t favicon_asset = GZ_ASSET(favicon_svg_gz, "image/svg+xml");
+
+static esp_err_t send_gz_asset(httpd_req_t *req, gz_asset_t *asset) {
+        if (!asset->etag[0]) {
+                uint32_t hash = 2166136261u;
+                for (const char *p = asset->start; p < asset->end; p++) {
+                        hash = (hash ^ (uint8_t)*p) * 16777619u;
+                }
+                snprintf(asset->etag, sizeof(asset->etag), "\"%08lx\"", (unsigned long)hash);
+        }
+
+        httpd_resp_set_hdr(req, "ETag", asset->etag);
+        // Always revalidate; a matching ETag costs one empty 304
+        httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+        char match[64];
+        if (httpd_req_get_hdr_value_str(req, "If-None-Match", match, sizeof(match)) == ESP_OK &&
+            (strstr(match, asset->etag) || strcmp(match, "*") == 0)) {
+                httpd_resp_set_status(req, "304 Not Modified");
+                return httpd_resp_send(req, NULL, 0);
+        }
+
+        httpd_resp_set_type(req, asset->type);
+        httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+        return httpd_resp_send(req, asset->start, asset->end - asset->start);
+}
+
 static esp_err_t index_handler(httpd_req_t *req) {
-        httpd_resp_set_type(req, "text/html");
-        httpd_resp_send(req, TEMPLATE(mgmt_index_html), TEMPLATE_LEN(mgmt_index_html));
-        return ESP_OK;
+        return send_gz_asset(req, &index_asset);
 }
 
 static esp_err_t favicon_handler(httpd_req_t *req) {
-        httpd_resp_set_type(req, "image/svg+xml");
-        httpd_resp_send(req, TEMPLATE(favicon_svg), TEMPLATE_LEN(favicon_svg));
-        return ESP_OK;
+        return send_gz_asset(req, &favicon_asset);
 }
 
 #define MAX_FILENAME_LEN 64
@@ -157,34 +195,6 @@ static esp_err_t freespace_handler(httpd_req_t *req) {
         return ESP_OK;
 }
 
-// Extract filename from Content-Disposition header
-// Looks for: filename="something.lua"
-static int extract_filename(const char *buf, int len, char *filename, int max_len) {
-        const char *needle = "filename=\"";
-        char *start = memmem(buf, len, needle, strlen(needle));
-        if (!start) return -1;
-
-        start += strlen(needle);
-        char *end = memchr(start, '"', len - (start - buf));
-        if (!end) return -1;
-
-        int name_len = end - start;
-        if (name_len <= 0 || name_len >= max_len) return -1;
-
-        // Copy and truncate to MAX_FILENAME_LEN
-        if (name_len > MAX_FILENAME_LEN) name_len = MAX_FILENAME_LEN;
-        memcpy(filename, start, name_len);
-        filename[name_len] = '\0';
-        return 0;
-}
-
-// Find end of multipart headers (double CRLF)
-static char *find_content_start(char *buf, int len) {
-        char *pos = memmem(buf, len, "\r\n\r\n", 4);
-        if (pos) return pos + 4;
-        return NULL;
-}
-
 // File delete handler - deletes file from /assets
 static esp_err_t delete_handler(httpd_req_t *req) {
         char query[128];
@@ -222,6 +232,8 @@ static esp_err_t delete_handler(httpd_req_t *req) {
         httpd_resp_set_status(req, "302 Found");
         httpd_resp_set_hdr(req, "Location", "/");
         httpd_resp_send(req, NULL, 0);
+        // The running script may have been the one deleted
+        lua_request_exit();
         return ESP_OK;
 }
 
@@ -246,69 +258,11 @@ static esp_err_t edit_handler(httpd_req_t *req) {
 
         httpd_resp_set_type(req, "text/html");
 
-        // Send the edit_html template with %FILENAME% replaced
-        const char *src = TEMPLATE(edit_html);
-        const char *end = src + TEMPLATE_LEN(edit_html);
-        const char *placeholder = "%FILENAME%";
-        const char *errortext = "%ERRORTEXT%";
-        size_t placeholder_len = strlen(placeholder);
-        size_t errortext_len = strlen(errortext);
-
-        while (src < end) {
-                // Search within remaining bounds
-                const char *pos = NULL;
-                const char *errpos = NULL;
-                size_t remaining = end - src;
-
-                // Find %FILENAME%
-                for (const char *p = src; p + placeholder_len <= end; p++) {
-                        if (memcmp(p, placeholder, placeholder_len) == 0) {
-                                pos = p;
-                                break;
-                        }
-                }
-
-                // Find %ERRORTEXT%
-                for (const char *p = src; p + errortext_len <= end; p++) {
-                        if (memcmp(p, errortext, errortext_len) == 0) {
-                                errpos = p;
-                                break;
-                        }
-                }
-
-                // Find which placeholder comes first
-                const char *first = NULL;
-                int is_filename = 0;
-                if (pos && (!errpos || pos < errpos)) {
-                        first = pos;
-                        is_filename = 1;
-                } else if (errpos) {
-                        first = errpos;
-                        is_filename = 0;
-                }
-
-                if (first) {
-                        // Send text before placeholder
-                        if (first > src) {
-                                httpd_resp_send_chunk(req, src, first - src);
-                        }
-                        // Send replacement
-                        if (is_filename) {
-                                httpd_resp_sendstr_chunk(req, filename);
-                                src = first + placeholder_len;
-                        } else {
-                                // Empty error text
-                                src = first + errortext_len;
-                        }
-                } else {
-                        // No more placeholders, send rest
-                        httpd_resp_send_chunk(req, src, end - src);
-                        break;
-                }
-        }
-
-        httpd_resp_sendstr_chunk(req, NULL);
-        return ESP_OK;
+        const char *values[EDIT_HTML_NUM_VALUES] = {
+                [EDIT_HTML_FILENAME] = filename,
+                [EDIT_HTML_ERRORTEXT] = "",
+        };
+        return template_send(req, &edit_html_tpl, values);
 }
 
 // Read file contents handler - returns raw file content
@@ -351,8 +305,6 @@ static esp_err_t readfile_handler(httpd_req_t *req) {
         return ESP_OK;
 }
 
-bool force_exit = false;
-
 // Save file handler - receives file content in POST body
 static esp_err_t save_handler(httpd_req_t *req) {
         char filename[MAX_FILENAME_LEN + 1] = {0};
@@ -392,47 +344,117 @@ static esp_err_t save_handler(httpd_req_t *req) {
         fclose(fp);
         ESP_LOGI(TAG, "Saved file: %s", filepath);
         httpd_resp_sendstr(req, "OK");
-        force_exit = true;
+        lua_request_exit();
         return ESP_OK;
 }
 
-// File upload handler - receives multipart/form-data
+// File upload handler - receives multipart/form-data with one or more
+// files. Each file is written to a .tmp name while it streams in and
+// renamed over the old one once its part is complete.
+typedef struct {
+        char path[80];
+        char tmp[88];
+        FILE *fp;
+        int files;
+        int status;
+        const char *error;
+} upload_ctx_t;
+
+static bool upload_fail(upload_ctx_t *up, int status, const char *error) {
+        up->status = status;
+        up->error = error;
+        return false;
+}
+
+static bool upload_part_begin(void *ctx, const multipart_part_t *part) {
+        upload_ctx_t *up = ctx;
+        if (!part->filename[0]) {
+                return true;    // plain form field, ignored
+        }
+
+        // Some browsers send the client-side path
+        const char *name = part->filename;
+        for (const char *p = name; *p; p++) {
+                if (*p == '/' || *p == '\\') name = p + 1;
+        }
+        if (!name[0] || strcmp(name, ".") == 0 || strcmp(name, "..") == 0 ||
+            strlen(name) > MAX_FILENAME_LEN) {
+                return upload_fail(up, HTTPD_400_BAD_REQUEST, "Bad filename");
+        }
+
+        snprintf(up->path, sizeof(up->path), "/assets/%s", name);
+        snprintf(up->tmp, sizeof(up->tmp), "%s.tmp", up->path);
+        ESP_LOGI(TAG, "Uploading file: %s", up->path);
+        up->fp = fopen(up->tmp, "wb");
+        if (!up->fp) {
+                ESP_LOGE(TAG, "Failed to open file for writing");
+                return upload_fail(up, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
+        }
+        return true;
+}
+
+static bool upload_data(void *ctx, const char *data, size_t len) {
+        upload_ctx_t *up = ctx;
+        if (up->fp && fwrite(data, 1, len, up->fp) != len) {
+                ESP_LOGE(TAG, "Write failed: %s", up->tmp);
+                return upload_fail(up, HTTPD_500_INTERNAL_SERVER_ERROR, "Write failed, filesystem full?");
+        }
+        return true;
+}
+
+static bool upload_part_end(void *ctx) {
+        upload_ctx_t *up = ctx;
+        if (!up->fp) {
+                return true;
+        }
+        int err = fclose(up->fp);
+        up->fp = NULL;
+        if (err != 0) {
+                remove(up->tmp);
+                return upload_fail(up, HTTPD_500_INTERNAL_SERVER_ERROR, "Write failed, filesystem full?");
+        }
+        remove(up->path);
+        if (rename(up->tmp, up->path) != 0) {
+                remove(up->tmp);
+                return upload_fail(up, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
+        }
+        ESP_LOGI(TAG, "Upload complete: %s", up->path);
+        up->files++;
+        return true;
+}
+
+static const multipart_callbacks_t upload_callbacks = {
+        .on_part_begin = upload_part_begin,
+        .on_data = upload_data,
+        .on_part_end = upload_part_end,
+};
+
 static esp_err_t upload_handler(httpd_req_t *req) {
+        upload_ctx_t up = { .fp = NULL, .files = 0 };
+        multipart_parser_t *parser = malloc(sizeof(multipart_parser_t));
         char *buf = malloc(UPLOAD_BUF_SIZE);
-        if (!buf) {
+        if (!parser || !buf) {
+                free(parser);
+                free(buf);
                 httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Out of memory");
                 return ESP_FAIL;
         }
 
-        char filename[MAX_FILENAME_LEN + 1] = {0};
-        char filepath[80];
-        FILE *fp = NULL;
-        int remaining = req->content_len;
-        int received = 0;
-        int header_parsed = 0;
-        char boundary[128] = {0};
-        int boundary_len = 0;
-
         // Get boundary from Content-Type header
-        char content_type[256];
-        if (httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type)) == ESP_OK) {
-                char *b = strstr(content_type, "boundary=");
-                if (b) {
-                        b += 9;
-                        snprintf(boundary, sizeof(boundary), "--%s", b);
-                        boundary_len = strlen(boundary);
-                }
-        }
-
-        if (boundary_len == 0) {
+        char content_type[256] = {0};
+        httpd_req_get_hdr_value_str(req, "Content-Type", content_type, sizeof(content_type));
+        if (!multipart_init(parser, content_type, &upload_callbacks, &up)) {
+                free(parser);
                 free(buf);
                 httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing boundary");
                 return ESP_FAIL;
         }
 
-        ESP_LOGI(TAG, "Upload starting, content_len=%d, boundary=%s", req->content_len, boundary);
+        ESP_LOGI(TAG, "Upload starting, content_len=%d", (int)req->content_len);
 
-        while (remaining > 0) {
+        int remaining = req->content_len;
+        multipart_result_t result = MULTIPART_OK;
+        while (remaining > 0 && result == MULTIPART_OK) {
                 int to_read = (remaining < UPLOAD_BUF_SIZE) ? remaining : UPLOAD_BUF_SIZE;
                 int ret = httpd_req_recv(req, buf, to_read);
                 if (ret <= 0) {
@@ -441,74 +463,33 @@ static esp_err_t upload_handler(httpd_req_t *req) {
                         break;
                 }
                 remaining -= ret;
-                received += ret;
-
-                if (!header_parsed) {
-                        // Parse multipart headers to get filename
-                        if (extract_filename(buf, ret, filename, sizeof(filename)) == 0) {
-                                snprintf(filepath, sizeof(filepath), "/assets/%s", filename);
-                                ESP_LOGI(TAG, "Uploading file: %s", filepath);
-
-                                fp = fopen(filepath, "w");
-                                if (!fp) {
-                                        ESP_LOGE(TAG, "Failed to open file for writing");
-                                        free(buf);
-                                        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to create file");
-                                        return ESP_FAIL;
-                                }
-
-                                // Find where actual file content starts
-                                char *content = find_content_start(buf, ret);
-                                if (content) {
-                                        int content_len = ret - (content - buf);
-                                        // Write initial content (may contain trailing boundary on small files)
-                                        fwrite(content, 1, content_len, fp);
-                                }
-                                header_parsed = 1;
-                        }
-                } else if (fp) {
-                        // Write file data
-                        fwrite(buf, 1, ret, fp);
-                }
+                result = multipart_feed(parser, buf, ret);
         }
 
-        if (fp) {
-                fclose(fp);
-
-                // Trim trailing boundary from file
-                // Re-open and truncate the trailing boundary bytes
-                struct stat st;
-                if (stat(filepath, &st) == 0 && st.st_size > boundary_len + 6) {
-                        // Read last bytes and check for boundary
-                        fp = fopen(filepath, "r+b");
-                        if (fp) {
-                                // Seek to check for boundary near end
-                                fseek(fp, -(boundary_len + 10), SEEK_END);
-                                char tail[150];
-                                int tail_len = fread(tail, 1, sizeof(tail) - 1, fp);
-                                tail[tail_len] = '\0';
-
-                                // Find boundary and truncate there
-                                char *bpos = strstr(tail, boundary);
-                                if (bpos) {
-                                        // Calculate new size (excluding boundary and preceding CRLF)
-                                        long new_size = st.st_size - tail_len + (bpos - tail);
-                                        if (new_size > 2 && bpos > tail && *(bpos-1) == '\n' && *(bpos-2) == '\r') {
-                                                new_size -= 2; // Remove CRLF before boundary
-                                        }
-                                        fclose(fp);
-                                        truncate(filepath, new_size);
-                                } else {
-                                        fclose(fp);
-                                }
-                        }
-                }
+        // A file whose closing delimiter never arrived is dropped
+        if (up.fp) {
+                fclose(up.fp);
+                remove(up.tmp);
+        }
+        free(parser);
+        free(buf);
 
-                ESP_LOGI(TAG, "Upload complete: %s", filename);
+        if (result == MULTIPART_ABORTED) {
+                httpd_resp_send_err(req, up.status, up.error);
+                return ESP_FAIL;
+        }
+        if (result != MULTIPART_DONE) {
+                ESP_LOGE(TAG, "Upload incomplete or malformed");
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Incomplete upload");
+                return ESP_FAIL;
         }
 
-        free(buf);
+        ESP_LOGI(TAG, "Upload finished, %d file(s)", up.files);
         httpd_resp_sendstr(req, "Upload complete");
+        // Restart so a new display.lua takes effect
+        if (up.files > 0) {
+                lua_request_exit();
+        }
         return ESP_OK;
 }
 
@@ -612,23 +593,17 @@ static esp_err_t mqtt_post_handler(httpd_req_t *req) {
         return ESP_OK;
 }
 
-void run_on_event(void* handler_arg, esp_event_base_t base, int32_t id, void* event_data)
-{
-    // Event handler logic
-    lua_request_pause(5000);
-}
-
-
 void mgmt_http_server_start(void) {
         if (server) return;
 
-        // Register event hook
-        ESP_ERROR_CHECK(esp_event_handler_instance_register(
-                ESP_HTTP_SERVER_EVENT, HTTP_SERVER_EVENT_ON_CONNECTED, run_on_event, NULL, NULL));
-
+        // The server shares nothing with the running script but the heap,
+        // where the Lua allocator leaves LUA_ALLOC_HEAP_RESERVE for it, so
+        // it runs on the network core and requests don't disturb the display
         httpd_config_t config = HTTPD_DEFAULT_CONFIG();
         config.server_port = 80;
         config.max_uri_handlers = 16;
+        config.core_id = NET_TASK_CORE;
+        config.task_priority = HTTPD_TASK_PRIORITY;
         httpd_start(&server, &config);
 
         httpd_uri_t index_uri = {
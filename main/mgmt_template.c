@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include "mgmt_template.h"
+
+#define ESCAPE_BUF_SIZE 128
+
+// Escaped output is batched so a long value costs a few chunks, not one
+// per character
+typedef struct {
+    httpd_req_t *req;
+    char buf[ESCAPE_BUF_SIZE];
+    size_t len;
+    esp_err_t err;
+} escape_out_t;
+
+static void out_flush(escape_out_t *out) {
+    if (out->len && out->err == ESP_OK) {
+        out->err = httpd_resp_send_chunk(out->req, out->buf, out->len);
+    }
+    out->len = 0;
+}
+
+static void out_put(escape_out_t *out, const char *s, size_t n) {
+    if (out->len + n > sizeof(out->buf)) {
+        out_flush(out);
+    }
+    if (n > sizeof(out->buf)) {
+        if (out->err == ESP_OK) {
+            out->err = httpd_resp_send_chunk(out->req, s, n);
+        }
+        return;
+    }
+    memcpy(out->buf + out->len, s, n);
+    out->len += n;
+}
+
+static void escape_html(escape_out_t *out, const char *s) {
+    for (; *s; s++) {
+        switch (*s) {
+            case '&': out_put(out, "&amp;", 5); break;
+            case '<': out_put(out, "&lt;", 4); break;
+            case '>': out_put(out, "&gt;", 4); break;
+            case '"': out_put(out, "&quot;", 6); break;
+            case '\'': out_put(out, "&#39;", 5); break;
+            default: out_put(out, s, 1); break;
+        }
+    }
+}
+
+// Backslashes are escaped; quotes, control characters, <, > and & become
+// \xNN, so the result is also safe inside an onclick="..." attribute (no
+// raw quote can end it) and can't close the <script> block it sits in
+static void escape_js(escape_out_t *out, const char *s) {
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '\\') {
+            out_put(out, "\\\\", 2);
+        } else if (c < 0x20 || c == '"' || c == '\'' || c == '<' || c == '>' || c == '&') {
+            char esc[5];
+            snprintf(esc, sizeof(esc), "\\x%02x", c);
+            out_put(out, esc, 4);
+        } else {
+            out_put(out, s, 1);
+        }
+    }
+}
+
+esp_err_t template_send(httpd_req_t *req, const template_t *tpl, const char *const *values) {
+    escape_out_t out = { .req = req, .len = 0, .err = ESP_OK };
+
+    for (uint16_t i = 0; i < tpl->num_segments && out.err == ESP_OK; i++) {
+        const template_segment_t *seg = &tpl->segments[i];
+        if (seg->len) {
+            out.err = httpd_resp_send_chunk(req, tpl->text + seg->offset, seg->len);
+        }
+        if (seg->value >= tpl->num_values || !values[seg->value]) {
+            continue;
+        }
+
+        const char *value = values[seg->value];
+        switch (seg->escape) {
+            case TEMPLATE_ESC_HTML: escape_html(&out, value); break;
+            case TEMPLATE_ESC_JS: escape_js(&out, value); break;
+            default: out_put(&out, value, strlen(value)); break;
+        }
+        out_flush(&out);
+    }
+
+    if (out.err == ESP_OK) {
+        out.err = httpd_resp_send_chunk(req, NULL, 0);
+    }
+    return out.err;
+}
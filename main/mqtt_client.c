@@ -2,7 +2,10 @@
  * MQTT Client implementation for luaMatrix
  */
 
+#include "local_lua.h"
+#include "lua_sched.h"
 #include "luamatrix_mqtt.h"
+#include "task_topology.h"
 #include "mqtt_client.h"  // ESP-IDF mqtt_client
 #include "esp_event.h"
 #include "esp_log.h"
@@ -14,9 +17,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 
-// From mgmt_http_server.c - triggers Lua script reload
-extern bool force_exit;
-
 #define MQTT_NAMESPACE "mqtt_config"
 
 static const char *TAG = "mqtt";
@@ -45,6 +45,7 @@ static mqtt_config_t s_config = {0};
 static SemaphoreHandle_t s_mutex = NULL;
 static bool s_connected = false;
 static QueueHandle_t s_msg_queue = NULL;
+static SemaphoreHandle_t s_queue_lock = NULL;   // held while the queue is rotated
 
 #define MQTT_MSG_QUEUE_SIZE 10
 
@@ -236,7 +237,8 @@ esp_err_t mqtt_client_init(void)
 
     if (s_msg_queue == NULL) {
         s_msg_queue = xQueueCreate(MQTT_MSG_QUEUE_SIZE, sizeof(mqtt_msg_t));
-        if (s_msg_queue == NULL) {
+        s_queue_lock = xSemaphoreCreateMutex();
+        if (s_msg_queue == NULL || s_queue_lock == NULL) {
             ESP_LOGE(TAG, "Failed to create message queue");
             return ESP_FAIL;
         }
@@ -266,8 +268,11 @@ esp_err_t mqtt_client_start(void)
     char uri[300];
     snprintf(uri, sizeof(uri), "mqtt://%s:%d", s_config.broker_url, s_config.port);
 
+    // The core comes from CONFIG_MQTT_USE_CORE_0 in sdkconfig.defaults
     esp_mqtt_client_config_t mqtt_cfg = {
         .broker.address.uri = uri,
+        .task.priority = MQTT_TASK_PRIORITY,
+        .task.stack_size = MQTT_TASK_STACK,
     };
 
     if (strlen(s_config.username) > 0) {
@@ -389,7 +394,7 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
                 fwrite(event->data, 1, event->data_len, fp);
                 fclose(fp);
                 ESP_LOGI(TAG, "Saved %d bytes to display.lua", event->data_len);
-                force_exit = true;
+                lua_request_exit();
             } else {
                 ESP_LOGE(TAG, "Failed to open display.lua for writing");
             }
@@ -410,9 +415,14 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base,
                 msg.data[event->data_len] = '\0';
                 msg.data_len = event->data_len;
 
-                if (xQueueSend(s_msg_queue, &msg, 0) != pdTRUE) {
+                xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+                BaseType_t queued = xQueueSend(s_msg_queue, &msg, 0);
+                xSemaphoreGive(s_queue_lock);
+                if (queued != pdTRUE) {
                     free(msg.data);
                     ESP_LOGW(TAG, "MQTT message queue full, dropping message");
+                } else {
+                    lua_sched_notify();
                 }
             }
         }
@@ -481,6 +491,44 @@ bool mqtt_get_pending_message(char *topic, size_t tlen, char *data, size_t dlen)
     return true;
 }
 
+bool mqtt_take_message(bool (*match)(const char *topic, void *arg), void *arg,
+                       char *topic, size_t tlen, char *data, size_t dlen)
+{
+    if (s_msg_queue == NULL) {
+        return false;
+    }
+
+    // Every queued message is taken out once and all but the first match
+    // go back in, so the rest keep their order. New messages wait for the
+    // lock instead of slipping in between.
+    bool found = false;
+    xSemaphoreTake(s_queue_lock, portMAX_DELAY);
+    UBaseType_t count = uxQueueMessagesWaiting(s_msg_queue);
+    for (UBaseType_t i = 0; i < count; i++) {
+        mqtt_msg_t msg;
+        if (xQueueReceive(s_msg_queue, &msg, 0) != pdTRUE) {
+            break;
+        }
+        if (found || !match(msg.topic, arg)) {
+            xQueueSend(s_msg_queue, &msg, 0);
+            continue;
+        }
+
+        if (topic && tlen > 0) {
+            strncpy(topic, msg.topic, tlen - 1);
+            topic[tlen - 1] = '\0';
+        }
+        if (data && dlen > 0 && msg.data) {
+            strncpy(data, msg.data, dlen - 1);
+            data[dlen - 1] = '\0';
+        }
+        free(msg.data);
+        found = true;
+    }
+    xSemaphoreGive(s_queue_lock);
+    return found;
+}
+
 bool mqtt_wait_for_message(char *topic, size_t tlen, char *data, size_t dlen, uint32_t timeout_ms)
 {
     if (s_msg_queue == NULL) {
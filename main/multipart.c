@@ -0,0 +1,222 @@
+#include <string.h>
+#include <strings.h>
+#include "multipart.h"
+
+enum {
+    ST_PREAMBLE,    // before the first delimiter
+    ST_DELIM_END,   // after a delimiter: "--" or CRLF, maybe after padding
+    ST_DELIM_DASH,  // seen one '-' of the closing "--"
+    ST_DELIM_LF,    // seen the CR ending a delimiter line
+    ST_HEADERS,
+    ST_BODY,
+    ST_FINISHED,
+};
+
+// Copies one parameter value of a header ("x.lua" or x.lua) into out.
+// Browsers percent-encode quotes in file names and send backslashes as-is
+// (old ones include a Windows path), so there is no unescaping.
+static void copy_param(const char *v, char *out, size_t out_size) {
+    size_t n = 0;
+    if (*v == '"') {
+        for (v++; *v && *v != '"'; v++) {
+            if (n + 1 < out_size) out[n++] = *v;
+        }
+    } else {
+        for (; *v && *v != ';' && *v != ' ' && *v != '\t'; v++) {
+            if (n + 1 < out_size) out[n++] = *v;
+        }
+    }
+    out[n] = '\0';
+}
+
+// Content-Disposition: form-data; name="file1"; filename="x.lua"
+static void parse_header(multipart_parser_t *p) {
+    static const char cd[] = "content-disposition:";
+    p->line[p->line_len < sizeof(p->line) ? p->line_len : sizeof(p->line) - 1] = '\0';
+    if (strncasecmp(p->line, cd, sizeof(cd) - 1) != 0) {
+        return;
+    }
+
+    const char *s = p->line + sizeof(cd) - 1;
+    while ((s = strchr(s, ';')) != NULL) {
+        s++;
+        while (*s == ' ' || *s == '\t') s++;
+        if (strncasecmp(s, "name=", 5) == 0) {
+            copy_param(s + 5, p->part.name, sizeof(p->part.name));
+        } else if (strncasecmp(s, "filename=", 9) == 0) {
+            copy_param(s + 9, p->part.filename, sizeof(p->part.filename));
+        }
+    }
+}
+
+static multipart_result_t stop(multipart_parser_t *p, multipart_result_t result) {
+    p->state = ST_FINISHED;
+    p->result = result;
+    return result;
+}
+
+bool multipart_init(multipart_parser_t *p, const char *content_type,
+                    const multipart_callbacks_t *cb, void *ctx) {
+    memset(p, 0, sizeof(*p));
+    p->cb = cb;
+    p->ctx = ctx;
+
+    // multipart/form-data; boundary=----WebKitFormBoundary...
+    char boundary[MULTIPART_BOUNDARY_MAX + 2] = "";
+    const char *s = content_type;
+    while (s && (s = strchr(s, ';')) != NULL) {
+        s++;
+        while (*s == ' ' || *s == '\t') s++;
+        if (strncasecmp(s, "boundary=", 9) == 0) {
+            copy_param(s + 9, boundary, sizeof(boundary));
+            break;
+        }
+    }
+    size_t len = strlen(boundary);
+    if (len == 0 || len > MULTIPART_BOUNDARY_MAX) {
+        return false;
+    }
+
+    memcpy(p->delim, "\r\n--", 4);
+    memcpy(p->delim + 4, boundary, len + 1);
+    p->delim_len = 4 + len;
+    // The first delimiter may start the body without a CRLF before it
+    p->match = 2;
+    p->state = ST_PREAMBLE;
+    p->result = MULTIPART_OK;
+    return true;
+}
+
+// Part contents: everything up to the next delimiter is handed to on_data
+// in as few calls as possible. A delimiter prefix at the end of a piece is
+// held back (it is just delim[0..match)) until the next piece decides it.
+static size_t feed_body(multipart_parser_t *p, const char *data, size_t len, size_t i) {
+    size_t carry = p->match;    // delimiter bytes held from the last piece
+    size_t run = i;             // first byte not passed to on_data yet
+    size_t mstart = i;          // where the current match began here
+
+    while (i < len) {
+        if (p->match == 0) {
+            const char *cr = memchr(data + i, '\r', len - i);
+            if (!cr) {
+                i = len;
+                break;
+            }
+            i = cr - data;
+            mstart = i;
+        }
+
+        if (data[i] == p->delim[p->match]) {
+            i++;
+            if (++p->match < p->delim_len) {
+                continue;
+            }
+            // Full delimiter: the part ends before it
+            size_t end = carry ? run : mstart;
+            p->match = 0;
+            if (end > run && !p->cb->on_data(p->ctx, data + run, end - run)) {
+                stop(p, MULTIPART_ABORTED);
+                return i;
+            }
+            if (!p->cb->on_part_end(p->ctx)) {
+                stop(p, MULTIPART_ABORTED);
+                return i;
+            }
+            p->state = ST_DELIM_END;
+            return i;
+        }
+
+        // Not a delimiter after all: the matched bytes are content
+        if (carry) {
+            if (!p->cb->on_data(p->ctx, p->delim, carry)) {
+                stop(p, MULTIPART_ABORTED);
+                return i;
+            }
+            carry = 0;
+        }
+        p->match = 0;
+        // data[i] is examined again; it may start a new match
+    }
+
+    // Hold back a delimiter prefix at the end of the piece
+    size_t end = len;
+    if (p->match) end = carry ? run : mstart;
+    if (end > run && !p->cb->on_data(p->ctx, data + run, end - run)) {
+        stop(p, MULTIPART_ABORTED);
+    }
+    return len;
+}
+
+multipart_result_t multipart_feed(multipart_parser_t *p, const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && p->state != ST_FINISHED) {
+        if (p->state == ST_BODY) {
+            i = feed_body(p, data, len, i);
+            continue;
+        }
+
+        char c = data[i++];
+        switch (p->state) {
+            case ST_PREAMBLE:
+                if (c == p->delim[p->match]) {
+                    if (++p->match == p->delim_len) {
+                        p->match = 0;
+                        p->state = ST_DELIM_END;
+                    }
+                } else {
+                    p->match = (c == p->delim[0]) ? 1 : 0;
+                }
+                break;
+
+            case ST_DELIM_END:
+                if (c == '-') {
+                    p->state = ST_DELIM_DASH;
+                } else if (c == '\r') {
+                    p->state = ST_DELIM_LF;
+                } else if (c != ' ' && c != '\t') {
+                    return stop(p, MULTIPART_ERROR);
+                }
+                break;
+
+            case ST_DELIM_DASH:
+                if (c != '-') {
+                    return stop(p, MULTIPART_ERROR);
+                }
+                return stop(p, MULTIPART_DONE);
+
+            case ST_DELIM_LF:
+                if (c != '\n') {
+                    return stop(p, MULTIPART_ERROR);
+                }
+                memset(&p->part, 0, sizeof(p->part));
+                p->line_len = 0;
+                p->state = ST_HEADERS;
+                break;
+
+            case ST_HEADERS:
+                if (c == '\r') {
+                    break;
+                }
+                if (c != '\n') {
+                    if (p->line_len < sizeof(p->line) - 1) {
+                        p->line[p->line_len] = c;
+                    }
+                    p->line_len++;
+                    break;
+                }
+                if (p->line_len > 0) {
+                    parse_header(p);
+                    p->line_len = 0;
+                    break;
+                }
+                // Blank line: contents follow
+                if (!p->cb->on_part_begin(p->ctx, &p->part)) {
+                    return stop(p, MULTIPART_ABORTED);
+                }
+                p->match = 0;
+                p->state = ST_BODY;
+                break;
+        }
+    }
+    return p->state == ST_FINISHED ? p->result : MULTIPART_OK;
+}
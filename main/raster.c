@@ -0,0 +1,673 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "display.h"
+#include "raster.h"
+
+// Drawing target for the primitive in progress. Drawing only ever happens
+// from one task at a time, so this doesn't need to be re-entrant.
+typedef struct {
+    uint8_t *canvas;
+    int width;
+    int height;
+    uint8_t r, g, b;
+} raster_target_t;
+
+static raster_target_t s_target;
+
+static inline void begin(int r, int g, int b) {
+    s_target.canvas = display_canvas();
+    s_target.width = get_width();
+    s_target.height = get_height();
+    s_target.r = r;
+    s_target.g = g;
+    s_target.b = b;
+}
+
+static inline int imin(int a, int b) { return a < b ? a : b; }
+static inline int imax(int a, int b) { return a > b ? a : b; }
+
+// Run on row y from x0 to x1 inclusive; x0 <= x1, not yet clipped
+static void fill_hspan(int x0, int x1, int y) {
+    if (y < 0 || y >= s_target.height) return;
+    if (x0 < 0) x0 = 0;
+    if (x1 >= s_target.width) x1 = s_target.width - 1;
+    if (x0 > x1) return;
+
+    uint8_t *p = s_target.canvas + ((size_t)y * s_target.width + x0) * 3;
+    for (int x = x0; x <= x1; x++) {
+        p[0] = s_target.r;
+        p[1] = s_target.g;
+        p[2] = s_target.b;
+        p += 3;
+    }
+    display_mark_dirty(x0, y, x1 - x0 + 1, 1);
+}
+
+// Run in column x from y0 to y1 inclusive; y0 <= y1, not yet clipped
+static void fill_vspan(int x, int y0, int y1) {
+    if (x < 0 || x >= s_target.width) return;
+    if (y0 < 0) y0 = 0;
+    if (y1 >= s_target.height) y1 = s_target.height - 1;
+    if (y0 > y1) return;
+
+    uint8_t *p = s_target.canvas + ((size_t)y0 * s_target.width + x) * 3;
+    size_t stride = (size_t)s_target.width * 3;
+    for (int y = y0; y <= y1; y++) {
+        p[0] = s_target.r;
+        p[1] = s_target.g;
+        p[2] = s_target.b;
+        p += stride;
+    }
+    display_mark_dirty(x, y0, 1, y1 - y0 + 1);
+}
+
+void raster_hspan(int x0, int x1, int y, int r, int g, int b) {
+    begin(r, g, b);
+    if (x0 > x1) {
+        int t = x0; x0 = x1; x1 = t;
+    }
+    fill_hspan(x0, x1, y);
+}
+
+// ============================================================================
+// Lines
+// ============================================================================
+
+// The classic all-octant Bresenham loop advances the major axis by one pixel
+// per step and, after k steps, has moved the minor axis by
+//     m(k) = floor((2 * minor * k + major) / (2 * major))
+// Having that in closed form lets us jump straight to the first visible
+// step instead of walking in from off-screen.
+
+// Smallest k in [0, major] with m(k) >= m; assumes 0 < m <= minor
+static int64_t first_step_reaching(int64_t m, int64_t major, int64_t minor) {
+    // 2*minor*k + major >= 2*major*m  <=>  k >= (2*major*m - major) / (2*minor)
+    int64_t num = 2 * major * m - major;
+    return (num + 2 * minor - 1) / (2 * minor);
+}
+
+// Clip the step range [*k0, *k1] so the minor coordinate
+// start + dir * m(k) stays within [0, limit)
+static void clip_minor_axis(int64_t *k0, int64_t *k1, int start, int dir, int limit,
+                            int64_t major, int64_t minor) {
+    int64_t m_lo, m_hi;
+    if (dir > 0) {
+        m_lo = -(int64_t)start;
+        m_hi = (int64_t)limit - 1 - start;
+    } else {
+        m_lo = (int64_t)start - (limit - 1);
+        m_hi = start;
+    }
+    if (m_lo < 0) m_lo = 0;
+    if (m_hi > minor) m_hi = minor;
+    if (m_lo > m_hi) {
+        *k1 = *k0 - 1;
+        return;
+    }
+    if (m_lo > 0) {
+        int64_t k = first_step_reaching(m_lo, major, minor);
+        if (k > *k0) *k0 = k;
+    }
+    if (m_hi < minor) {
+        int64_t k = first_step_reaching(m_hi + 1, major, minor) - 1;
+        if (k < *k1) *k1 = k;
+    }
+}
+
+// Clip the step range [*k0, *k1] so the major coordinate start + dir * k
+// stays within [0, limit)
+static void clip_major_axis(int64_t *k0, int64_t *k1, int start, int dir, int limit) {
+    int64_t lo, hi;
+    if (dir > 0) {
+        lo = -(int64_t)start;
+        hi = (int64_t)limit - 1 - start;
+    } else {
+        lo = (int64_t)start - (limit - 1);
+        hi = start;
+    }
+    if (lo > *k0) *k0 = lo;
+    if (hi < *k1) *k1 = hi;
+}
+
+void raster_line(int x0, int y0, int x1, int y1, int r, int g, int b) {
+    begin(r, g, b);
+
+    // Reject lines whose bounding box misses the panel
+    if (imax(x0, x1) < 0 || imin(x0, x1) >= s_target.width ||
+        imax(y0, y1) < 0 || imin(y0, y1) >= s_target.height) {
+        return;
+    }
+
+    int64_t dx = llabs((int64_t)x1 - x0);
+    int64_t dy = llabs((int64_t)y1 - y0);
+    int sx = x0 < x1 ? 1 : -1;
+    int sy = y0 < y1 ? 1 : -1;
+    bool x_major = dx >= dy;
+    int64_t major = x_major ? dx : dy;
+    int64_t minor = x_major ? dy : dx;
+
+    if (major == 0) {
+        fill_hspan(x0, x0, y0);
+        return;
+    }
+
+    // Visible range of steps
+    int64_t k0 = 0, k1 = major;
+    if (x_major) {
+        clip_major_axis(&k0, &k1, x0, sx, s_target.width);
+        clip_minor_axis(&k0, &k1, y0, sy, s_target.height, major, minor);
+    } else {
+        clip_major_axis(&k0, &k1, y0, sy, s_target.height);
+        clip_minor_axis(&k0, &k1, x0, sx, s_target.width, major, minor);
+    }
+    if (k0 > k1) return;
+
+    // m(k) as quotient and remainder, stepped without further division
+    int64_t num = 2 * minor * k0 + major;
+    int64_t m = num / (2 * major);
+    int64_t rem = num % (2 * major);
+
+    // Consecutive steps with the same minor coordinate form one run
+    int64_t run_start = k0;
+    for (int64_t k = k0; k <= k1; k++) {
+        bool last = (k == k1);
+        int64_t next_m = m;
+        if (!last) {
+            rem += 2 * minor;
+            if (rem >= 2 * major) {
+                rem -= 2 * major;
+                next_m++;
+            }
+        }
+        if (last || next_m != m) {
+            int a = (int)(sx * (x_major ? run_start : m) + x0);
+            int c = (int)(sy * (x_major ? m : run_start) + y0);
+            if (x_major) {
+                int e = (int)(x0 + sx * k);
+                fill_hspan(imin(a, e), imax(a, e), c);
+            } else {
+                int e = (int)(y0 + sy * k);
+                fill_vspan(a, imin(c, e), imax(c, e));
+            }
+            run_start = k + 1;
+            m = next_m;
+        }
+    }
+}
+
+// ============================================================================
+// Circles
+// ============================================================================
+
+void raster_circle(int cx, int cy, int radius, int r, int g, int b) {
+    begin(r, g, b);
+    if (radius < 0) return;
+    if (cx + radius < 0 || cx - radius >= s_target.width ||
+        cy + radius < 0 || cy - radius >= s_target.height) {
+        return;
+    }
+
+    int x = radius;
+    int y = 0;
+    int d = 1 - radius;
+    // Start of the current run of steps that share the same x. In the
+    // flat octants (rows cy +- x) such a run is one horizontal span.
+    int run_y = 0;
+
+    while (x >= y) {
+        // Steep octants: one pixel per row
+        fill_hspan(cx + x, cx + x, cy + y);
+        fill_hspan(cx - x, cx - x, cy + y);
+        fill_hspan(cx + x, cx + x, cy - y);
+        fill_hspan(cx - x, cx - x, cy - y);
+
+        int px = x, py = y;
+        y++;
+        if (d < 0) {
+            d += 2 * y + 1;
+        } else {
+            x--;
+            d += 2 * (y - x) + 1;
+        }
+
+        // Flat octants: emit once x is about to change or the loop ends
+        if (x != px || x < y) {
+            fill_hspan(cx + run_y, cx + py, cy + px);
+            fill_hspan(cx - py, cx - run_y, cy + px);
+            fill_hspan(cx + run_y, cx + py, cy - px);
+            fill_hspan(cx - py, cx - run_y, cy - px);
+            run_y = y;
+        }
+    }
+}
+
+// Per-row half widths for the filled circle, indexed by screen row
+static int *s_row_extent;
+static int s_row_extent_len;
+
+static inline void widen_row(int row, int half) {
+    if (row >= 0 && row < s_target.height && half > s_row_extent[row]) {
+        s_row_extent[row] = half;
+    }
+}
+
+void raster_filled_circle(int cx, int cy, int radius, int r, int g, int b) {
+    begin(r, g, b);
+    if (radius < 0) return;
+    if (cx + radius < 0 || cx - radius >= s_target.width ||
+        cy + radius < 0 || cy - radius >= s_target.height) {
+        return;
+    }
+
+    if (s_row_extent_len < s_target.height) {
+        int *rows = realloc(s_row_extent, s_target.height * sizeof(int));
+        if (rows == NULL) return;
+        s_row_extent = rows;
+        s_row_extent_len = s_target.height;
+    }
+
+    // The midpoint loop covers some rows several times with different
+    // widths. Collect the widest for each row, then draw each row once.
+    int row_lo = imax(cy - radius, 0);
+    int row_hi = imin(cy + radius, s_target.height - 1);
+    for (int row = row_lo; row <= row_hi; row++) {
+        s_row_extent[row] = -1;
+    }
+
+    int x = radius;
+    int y = 0;
+    int d = 1 - radius;
+
+    while (x >= y) {
+        widen_row(cy + y, x);
+        widen_row(cy - y, x);
+        widen_row(cy + x, y);
+        widen_row(cy - x, y);
+
+        y++;
+        if (d < 0) {
+            d += 2 * y + 1;
+        } else {
+            x--;
+            d += 2 * (y - x) + 1;
+        }
+    }
+
+    for (int row = row_lo; row <= row_hi; row++) {
+        int half = s_row_extent[row];
+        if (half >= 0) {
+            fill_hspan(cx - half, cx + half, row);
+        }
+    }
+}
+
+// ============================================================================
+// Triangles
+// ============================================================================
+
+// Walks x = xs + trunc((xe - xs) * (y - ys) / (ye - ys)) one scanline at a
+// time. Quotient and remainder are carried along, so the result matches
+// the per-scanline division exactly with only one division at setup.
+typedef struct {
+    int xs;
+    int sign;
+    int64_t q, rem;
+    int64_t q_step, rem_step;
+    int64_t den;
+} edge_t;
+
+static void edge_init(edge_t *e, int xs, int ys, int xe, int ye, int y) {
+    int64_t dx = (int64_t)xe - xs;
+    int64_t adx = dx < 0 ? -dx : dx;
+    int64_t t = (int64_t)y - ys;
+    e->xs = xs;
+    e->sign = dx < 0 ? -1 : 1;
+    e->den = (int64_t)ye - ys;
+    e->q = adx * t / e->den;
+    e->rem = adx * t % e->den;
+    e->q_step = adx / e->den;
+    e->rem_step = adx % e->den;
+}
+
+static inline int edge_x(const edge_t *e) {
+    return (int)(e->xs + e->sign * e->q);
+}
+
+static inline void edge_step(edge_t *e) {
+    e->q += e->q_step;
+    e->rem += e->rem_step;
+    if (e->rem >= e->den) {
+        e->rem -= e->den;
+        e->q++;
+    }
+}
+
+static inline void swap_int(int *a, int *b) {
+    int t = *a; *a = *b; *b = t;
+}
+
+void raster_filled_triangle(int x0, int y0, int x1, int y1, int x2, int y2, int r, int g, int b) {
+    begin(r, g, b);
+
+    // Sort vertices by y-coordinate (y0 <= y1 <= y2)
+    if (y0 > y1) { swap_int(&y0, &y1); swap_int(&x0, &x1); }
+    if (y1 > y2) { swap_int(&y1, &y2); swap_int(&x1, &x2); }
+    if (y0 > y1) { swap_int(&y0, &y1); swap_int(&x0, &x1); }
+
+    if (y2 < 0 || y0 >= s_target.height) return;
+    if (imax(x0, imax(x1, x2)) < 0 || imin(x0, imin(x1, x2)) >= s_target.width) return;
+
+    if (y0 == y2) {
+        // Degenerate case - horizontal line
+        fill_hspan(imin(x0, imin(x1, x2)), imax(x0, imax(x1, x2)), y0);
+        return;
+    }
+
+    int y_start = imax(y0, 0);
+    int y_end = imin(y2, s_target.height - 1);
+
+    // Long edge spans the whole triangle, the short one switches at y1.
+    // A flat-top triangle never sets up the short edge.
+    edge_t long_edge;
+    edge_t short_edge = {0};
+    edge_init(&long_edge, x0, y0, x2, y2, y_start);
+    bool upper = y_start < y1;
+    if (upper) {
+        edge_init(&short_edge, x0, y0, x1, y1, y_start);
+    } else if (y1 != y2) {
+        edge_init(&short_edge, x1, y1, x2, y2, y_start);
+    }
+
+    for (int y = y_start; y <= y_end; y++) {
+        if (upper && y == y1) {
+            upper = false;
+            if (y1 != y2) {
+                edge_init(&short_edge, x1, y1, x2, y2, y);
+            }
+        }
+
+        // With y1 == y2 the lower part is just the last scanline at x1
+        int xa = (!upper && y1 == y2) ? x1 : edge_x(&short_edge);
+        int xb = edge_x(&long_edge);
+        if (xa > xb) swap_int(&xa, &xb);
+        fill_hspan(xa, xb, y);
+
+        edge_step(&long_edge);
+        if (upper || y1 != y2) {
+            edge_step(&short_edge);
+        }
+    }
+}
+
+// ============================================================================
+// Glyphs
+// ============================================================================
+
+void raster_glyph(int x, int y, const void *rows, int bytes_per_row, int w, int h,
+                  int r, int g, int b) {
+    int width = get_width();
+    int height = get_height();
+    if (x >= width || x + w <= 0 || y >= height || y + h <= 0) return;
+
+    begin(r, g, b);
+
+    // Visible columns as a mask, so clipping a row is a single AND. Masks
+    // are 64-bit so a full 32-column row still has a clear bit above it.
+    int col_lo = imax(0, -x);
+    int col_hi = imin(w, width - x);
+    uint64_t visible = ((1ull << col_hi) - 1) & ~((1ull << col_lo) - 1);
+    int row_lo = imax(0, -y);
+    int row_hi = imin(h, height - y);
+
+    const uint8_t *rows8 = rows;
+    const uint16_t *rows16 = rows;
+    const uint32_t *rows32 = rows;
+    bool drawn = false;
+
+    for (int row = row_lo; row < row_hi; row++) {
+        uint64_t bits = bytes_per_row == 1 ? rows8[row] :
+                        bytes_per_row == 2 ? rows16[row] : rows32[row];
+        bits &= visible;
+        uint8_t *line = s_target.canvas + ((size_t)(y + row) * width + x) * 3;
+
+        while (bits) {
+            int start = __builtin_ctzll(bits);
+            int len = __builtin_ctzll(~(bits >> start));
+            uint8_t *p = line + start * 3;
+            for (int i = 0; i < len; i++) {
+                p[0] = s_target.r;
+                p[1] = s_target.g;
+                p[2] = s_target.b;
+                p += 3;
+            }
+            bits &= ~(((1ull << len) - 1) << start);
+            drawn = true;
+        }
+    }
+
+    // One dirty rectangle for the whole clipped cell rather than per run
+    if (drawn) {
+        display_mark_dirty(x + col_lo, y + row_lo, col_hi - col_lo, row_hi - row_lo);
+    }
+}
+
+// ============================================================================
+// Anti-aliasing
+// ============================================================================
+
+// Coverage is 4-bit (0 = untouched, 15 = solid). Blending a channel is
+// s_blend[a][src] + s_blend[15 - a][dst], where s_blend[a][v] is v * a / 15
+// rounded. The two terms never sum past 255.
+#define AA_LEVELS 16
+#define AA_MAX (AA_LEVELS - 1)
+
+static bool s_antialias;
+static bool s_blend_ready;
+static uint8_t s_blend[AA_LEVELS][256];
+
+static void blend_init(void) {
+    if (s_blend_ready) return;
+    for (int a = 0; a < AA_LEVELS; a++) {
+        for (int v = 0; v < 256; v++) {
+            s_blend[a][v] = (v * a + AA_MAX / 2) / AA_MAX;
+        }
+    }
+    s_blend_ready = true;
+}
+
+void raster_set_antialias(bool on) {
+    if (on) blend_init();
+    s_antialias = on;
+}
+
+bool raster_antialias(void) {
+    return s_antialias;
+}
+
+static inline void blend_at(uint8_t *p, int a) {
+    const uint8_t *src = s_blend[a];
+    const uint8_t *dst = s_blend[AA_MAX - a];
+    p[0] = src[s_target.r] + dst[p[0]];
+    p[1] = src[s_target.g] + dst[p[1]];
+    p[2] = src[s_target.b] + dst[p[2]];
+}
+
+static inline void blend_pixel(int x, int y, int a) {
+    if (a <= 0 || x < 0 || y < 0 || x >= s_target.width || y >= s_target.height) return;
+    blend_at(s_target.canvas + ((size_t)y * s_target.width + x) * 3, a);
+}
+
+// Clips an inclusive bounding box and marks it dirty
+static void mark_box(int x0, int y0, int x1, int y1) {
+    x0 = imax(x0, 0);
+    y0 = imax(y0, 0);
+    x1 = imin(x1, s_target.width - 1);
+    y1 = imin(y1, s_target.height - 1);
+    if (x0 <= x1 && y0 <= y1) {
+        display_mark_dirty(x0, y0, x1 - x0 + 1, y1 - y0 + 1);
+    }
+}
+
+// Xiaolin Wu's line with 16.16 fixed point. Horizontal, vertical and
+// 45-degree lines have nothing to smooth and use the solid path.
+void raster_line_aa(int x0, int y0, int x1, int y1, int r, int g, int b) {
+    int64_t dx = (int64_t)x1 - x0;
+    int64_t dy = (int64_t)y1 - y0;
+    if (dx == 0 || dy == 0 || llabs(dx) == llabs(dy)) {
+        raster_line(x0, y0, x1, y1, r, g, b);
+        return;
+    }
+
+    begin(r, g, b);
+    blend_init();
+    if (imax(x0, x1) < 0 || imin(x0, x1) >= s_target.width ||
+        imax(y0, y1) < 0 || imin(y0, y1) >= s_target.height) {
+        return;
+    }
+
+    // Work in major/minor coordinates, major axis increasing
+    bool steep = llabs(dy) > llabs(dx);
+    int ma0 = steep ? y0 : x0, mi0 = steep ? x0 : y0;
+    int ma1 = steep ? y1 : x1, mi1 = steep ? x1 : y1;
+    if (ma0 > ma1) {
+        swap_int(&ma0, &ma1);
+        swap_int(&mi0, &mi1);
+    }
+    int major_limit = steep ? s_target.height : s_target.width;
+    int minor_limit = steep ? s_target.width : s_target.height;
+
+    int64_t grad = ((int64_t)mi1 - mi0) * 65536 / ((int64_t)ma1 - ma0);
+    int start = imax(ma0, 0);
+    int end = imin(ma1, major_limit - 1);
+    int64_t inter = (int64_t)mi0 * 65536 + grad * ((int64_t)start - ma0);
+    int lo = INT32_MAX, hi = INT32_MIN;
+
+    for (int m = start; m <= end; m++, inter += grad) {
+        int mi = (int)(inter >> 16);
+        int frac = (int)((inter >> 12) & AA_MAX);
+        if (mi + 1 < 0 || mi >= minor_limit) continue;
+        if (steep) {
+            blend_pixel(mi, m, AA_MAX - frac);
+            blend_pixel(mi + 1, m, frac);
+        } else {
+            blend_pixel(m, mi, AA_MAX - frac);
+            blend_pixel(m, mi + 1, frac);
+        }
+        lo = imin(lo, mi);
+        hi = imax(hi, mi + 1);
+    }
+
+    if (lo <= hi) {
+        if (steep) mark_box(lo, start, hi, end);
+        else mark_box(start, lo, end, hi);
+    }
+}
+
+// Integer square root, rounded down
+static uint32_t isqrt64(uint64_t v) {
+    uint64_t res = 0;
+    uint64_t bit = 1ull << 62;
+    while (bit > v) bit >>= 2;
+    while (bit) {
+        if (v >= res + bit) {
+            v -= res + bit;
+            res = (res >> 1) + bit;
+        } else {
+            res >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)res;
+}
+
+// Blends the symmetric images of octant point (x, y), x >= y >= 0, without
+// touching any pixel twice
+static void blend_octants(int cx, int cy, int x, int y, int a) {
+    blend_pixel(cx + x, cy + y, a);
+    blend_pixel(cx - x, cy - y, a);
+    if (y != 0) {
+        blend_pixel(cx + x, cy - y, a);
+        blend_pixel(cx - x, cy + y, a);
+    }
+    if (x != y) {
+        blend_pixel(cx + y, cy + x, a);
+        blend_pixel(cx - y, cy - x, a);
+        if (y != 0) {
+            blend_pixel(cx - y, cy + x, a);
+            blend_pixel(cx + y, cy - x, a);
+        }
+    }
+}
+
+// Wu-style circle: for every row of the first octant the exact boundary
+// sqrt(r^2 - y^2) is found in 4-bit fixed point and split across the two
+// pixels it falls between
+void raster_circle_aa(int cx, int cy, int radius, int r, int g, int b) {
+    begin(r, g, b);
+    blend_init();
+    if (radius < 0) return;
+    if (cx + radius < 0 || cx - radius >= s_target.width ||
+        cy + radius < 0 || cy - radius >= s_target.height) {
+        return;
+    }
+
+    int64_t r2 = (int64_t)radius * radius;
+    for (int y = 0; (int64_t)y * y <= r2; y++) {
+        uint32_t xf = isqrt64((uint64_t)(r2 - (int64_t)y * y) << 8);
+        int x = xf >> 4;
+        int frac = xf & AA_MAX;
+        if (x < y) break;
+        blend_octants(cx, cy, x, y, AA_MAX - frac);
+        if (frac > 0) {
+            blend_octants(cx, cy, x + 1, y, frac);
+        }
+    }
+
+    mark_box(cx - radius - 1, cy - radius - 1, cx + radius + 1, cy + radius + 1);
+}
+
+// 4-bit coverage glyph: rows of stride bytes, two pixels per byte with the
+// low nibble on the left. Without anti-aliasing coverage is thresholded,
+// so the glyph still comes out as plain 1-bit pixels.
+void raster_glyph_aa(int x, int y, const uint8_t *data, int stride, int w, int h,
+                     int r, int g, int b) {
+    int width = get_width();
+    int height = get_height();
+    if (x >= width || x + w <= 0 || y >= height || y + h <= 0) return;
+
+    begin(r, g, b);
+    blend_init();
+
+    int col_lo = imax(0, -x);
+    int col_hi = imin(w, width - x);
+    int row_lo = imax(0, -y);
+    int row_hi = imin(h, height - y);
+    bool drawn = false;
+
+    for (int row = row_lo; row < row_hi; row++) {
+        const uint8_t *src = data + row * stride;
+        uint8_t *p = s_target.canvas + ((size_t)(y + row) * width + x + col_lo) * 3;
+        for (int col = col_lo; col < col_hi; col++, p += 3) {
+            int a = (src[col >> 1] >> ((col & 1) * 4)) & AA_MAX;
+            if (a == 0) continue;
+            if (!s_antialias) {
+                if (a < AA_LEVELS / 2) continue;
+                a = AA_MAX;
+            }
+            if (a == AA_MAX) {
+                p[0] = s_target.r;
+                p[1] = s_target.g;
+                p[2] = s_target.b;
+            } else {
+                blend_at(p, a);
+            }
+            drawn = true;
+        }
+    }
+
+    if (drawn) {
+        display_mark_dirty(x + col_lo, y + row_lo, col_hi - col_lo, row_hi - row_lo);
+    }
+}
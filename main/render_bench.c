@@ -0,0 +1,172 @@
+#include <lauxlib.h>
+#include <lua.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "display.h"
+#include "luafuncs.h"
+#include "render_bench.h"
+
+static const char* TAG = "bench";
+
+// Each benchmark is repeated, doubling the call count, until one batch
+// takes at least this long
+#define BENCH_MIN_TIME_US 100000
+#define BENCH_MAX_CALLS   (1 << 24)
+
+// All coordinates fit the smallest (64x64) panel layout
+#define BENCH_TEXT "Hello, World"
+#define BENCH_TEXT_LEN 12
+
+static void c_clear_display(void)         { clear_display(); }
+static void c_set_pixel(void)             { set_pixel(10, 10, 255, 0, 0); }
+static void c_draw_hline(void)            { horiz_line(0, 10, 64, 0, 255, 0); }
+static void c_draw_vline(void)            { vert_line(10, 0, 64, 0, 0, 255); }
+static void c_fill_rect(void)             { fill_rect(0, 0, 32, 32, 255, 255, 0); }
+static void c_draw_line(void)             { draw_line(0, 0, 63, 63, 255, 0, 255); }
+static void c_draw_circle(void)           { draw_circle(32, 32, 20, 0, 255, 255); }
+static void c_draw_filled_circle(void)    { draw_filled_circle(32, 32, 20, 255, 128, 0); }
+static void c_draw_triangle(void)         { draw_triangle(2, 2, 60, 10, 20, 60, 128, 255, 0); }
+static void c_draw_filled_triangle(void)  { draw_filled_triangle(2, 2, 60, 10, 20, 60, 0, 128, 255); }
+static void c_draw_string_3(void)         { draw_text(BENCH_TEXT, 0, 0, 255, 255, 255, 3); }
+static void c_draw_string_5(void)         { draw_text(BENCH_TEXT, 0, 0, 255, 255, 255, 5); }
+static void c_draw_string_8(void)         { draw_text(BENCH_TEXT, 0, 0, 255, 255, 255, 8); }
+static void c_draw_string_16(void)        { draw_text(BENCH_TEXT, 0, 0, 255, 255, 255, 16); }
+
+typedef struct {
+    const char *name;       // Lua binding being measured
+    const char *variant;    // Distinguishes calls to the same binding
+    void (*c_call)(void);   // One call through the C API
+    const char *lua_call;   // The same call as a Lua statement
+    int pixels;             // Nominal pixels covered by one call
+} bench_t;
+
+static const bench_t s_benches[] = {
+    { "clear_display", "", c_clear_display, "clear_display()", -1 },
+    { "set_pixel", "", c_set_pixel, "set_pixel(10, 10, 255, 0, 0)", 1 },
+    { "draw_hline", "", c_draw_hline, "draw_hline(0, 10, 64, 0, 255, 0)", 64 },
+    { "draw_vline", "", c_draw_vline, "draw_vline(10, 0, 64, 0, 0, 255)", 64 },
+    { "fill_rect", "32x32", c_fill_rect, "fill_rect(0, 0, 32, 32, 255, 255, 0)", 32 * 32 },
+    { "draw_line", "diagonal", c_draw_line, "draw_line(0, 0, 63, 63, 255, 0, 255)", 64 },
+    // Circumference 2*pi*r and area pi*r^2 for r = 20
+    { "draw_circle", "r=20", c_draw_circle, "draw_circle(32, 32, 20, 0, 255, 255)", 126 },
+    { "draw_filled_circle", "r=20", c_draw_filled_circle, "draw_filled_circle(32, 32, 20, 255, 128, 0)", 1257 },
+    // Sum of the three edge lengths, and the shoelace area
+    { "draw_triangle", "", c_draw_triangle, "draw_triangle(2, 2, 60, 10, 20, 60, 128, 255, 0)", 166 },
+    { "draw_filled_triangle", "", c_draw_filled_triangle, "draw_filled_triangle(2, 2, 60, 10, 20, 60, 0, 128, 255)", 1610 },
+    // Text counts every pixel of every glyph cell, lit or not
+    { "draw_string", "size=3", c_draw_string_3, "draw_string('" BENCH_TEXT "', 0, 0, 255, 255, 255, 3)", BENCH_TEXT_LEN * 3 * 3 },
+    { "draw_string", "size=5", c_draw_string_5, "draw_string('" BENCH_TEXT "', 0, 0, 255, 255, 255, 5)", BENCH_TEXT_LEN * 5 * 5 },
+    { "draw_string", "size=8", c_draw_string_8, "draw_string('" BENCH_TEXT "', 0, 0, 255, 255, 255, 8)", BENCH_TEXT_LEN * 8 * 8 },
+    { "draw_string", "size=16", c_draw_string_16, "draw_string('" BENCH_TEXT "', 0, 0, 255, 255, 255, 16)", BENCH_TEXT_LEN * 16 * 16 },
+    { "millis", "", NULL, "millis()", 0 },
+};
+
+#define BENCH_COUNT (sizeof(s_benches) / sizeof(s_benches[0]))
+
+typedef struct {
+    uint32_t calls;
+    int64_t elapsed_us;
+} bench_result_t;
+
+static int64_t time_c_calls(void (*fn)(void), uint32_t calls) {
+    int64_t start = esp_timer_get_time();
+    for (uint32_t i = 0; i < calls; i++) {
+        fn();
+    }
+    return esp_timer_get_time() - start;
+}
+
+// Expects the compiled loop chunk on top of the stack; leaves it there.
+// Errors (including a restart request from the debug hook) propagate.
+static int64_t time_lua_calls(lua_State *LUA, uint32_t calls) {
+    lua_pushvalue(LUA, -1);
+    lua_pushinteger(LUA, calls);
+    int64_t start = esp_timer_get_time();
+    lua_call(LUA, 1, 0);
+    return esp_timer_get_time() - start;
+}
+
+static bench_result_t run_c_bench(const bench_t *bench) {
+    bench_result_t res = { 0, 0 };
+    for (uint32_t calls = 1; calls <= BENCH_MAX_CALLS; calls *= 2) {
+        res.calls = calls;
+        res.elapsed_us = time_c_calls(bench->c_call, calls);
+        if (res.elapsed_us >= BENCH_MIN_TIME_US) break;
+    }
+    return res;
+}
+
+static bench_result_t run_lua_bench(lua_State *LUA, const bench_t *bench) {
+    bench_result_t res = { 0, 0 };
+    // Wrap the call in a numeric for loop so the measurement includes the
+    // interpreter's global lookup and argument passing, but no C->Lua
+    // transition per call
+    lua_pushfstring(LUA, "local n = ... for i = 1, n do %s end", bench->lua_call);
+    if (luaL_loadstring(LUA, lua_tostring(LUA, -1)) != LUA_OK) {
+        lua_error(LUA);
+    }
+    lua_remove(LUA, -2);
+
+    for (uint32_t calls = 1; calls <= BENCH_MAX_CALLS; calls *= 2) {
+        res.calls = calls;
+        res.elapsed_us = time_lua_calls(LUA, calls);
+        if (res.elapsed_us >= BENCH_MIN_TIME_US) break;
+    }
+    lua_pop(LUA, 1);
+    return res;
+}
+
+static void add_result_json(luaL_Buffer *buf, const char *mode, bench_result_t res, int pixels) {
+    char tmp[160];
+    double ns_per_call = (double)res.elapsed_us * 1000.0 / res.calls;
+    double calls_per_sec = (res.elapsed_us > 0) ? res.calls * 1e6 / res.elapsed_us : 0;
+    snprintf(tmp, sizeof(tmp),
+             "\"%s\":{\"calls\":%u,\"elapsed_us\":%lld,\"ns_per_call\":%.1f,\"pixels_per_sec\":%.0f}",
+             mode, (unsigned)res.calls, (long long)res.elapsed_us, ns_per_call, calls_per_sec * pixels);
+    luaL_addstring(buf, tmp);
+}
+
+int lua_render_bench(lua_State *LUA) {
+    int width = get_width();
+    int height = get_height();
+    bench_result_t c_res[BENCH_COUNT];
+    bench_result_t lua_res[BENCH_COUNT];
+
+    // Run everything first - the luaL_Buffer below must not be interleaved
+    // with the stack traffic of the Lua benchmarks
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        const bench_t *bench = &s_benches[i];
+        ESP_LOGI(TAG, "%s %s", bench->name, bench->variant);
+        if (bench->c_call) {
+            c_res[i] = run_c_bench(bench);
+        }
+        lua_res[i] = run_lua_bench(LUA, bench);
+    }
+    clear_display();
+
+    luaL_Buffer buf;
+    char tmp[128];
+    luaL_buffinit(LUA, &buf);
+    snprintf(tmp, sizeof(tmp), "{\"panel\":{\"width\":%d,\"height\":%d},\"results\":[", width, height);
+    luaL_addstring(&buf, tmp);
+
+    for (size_t i = 0; i < BENCH_COUNT; i++) {
+        const bench_t *bench = &s_benches[i];
+        int pixels = (bench->pixels < 0) ? width * height : bench->pixels;
+
+        snprintf(tmp, sizeof(tmp), "%s{\"name\":\"%s\",\"variant\":\"%s\",\"pixels\":%d,",
+                 i ? "," : "", bench->name, bench->variant, pixels);
+        luaL_addstring(&buf, tmp);
+        if (bench->c_call) {
+            add_result_json(&buf, "c", c_res[i], pixels);
+            luaL_addchar(&buf, ',');
+        }
+        add_result_json(&buf, "lua", lua_res[i], pixels);
+        luaL_addchar(&buf, '}');
+    }
+    luaL_addstring(&buf, "]}");
+    luaL_pushresult(&buf);
+    return 1;
+}
@@ -0,0 +1,23 @@
+#include <stddef.h>
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "task_topology.h"
+
+static const char* TAG = "tasks";
+
+// Ours, then the ESP-IDF tasks they talk to
+static const char *const s_task_names[] = {
+    "lua", "display_flush", "http_worker", "lua_memwatch",
+    "httpd", "mqtt_task", "tiT", "sys_evt", "dns_server",
+};
+
+void task_topology_report_stacks(void) {
+    for (size_t i = 0; i < sizeof(s_task_names) / sizeof(s_task_names[0]); i++) {
+        TaskHandle_t task = xTaskGetHandle(s_task_names[i]);
+        if (task == NULL) continue;
+        // ESP-IDF counts stack in bytes
+        ESP_LOGI(TAG, "%-14s %5u bytes of stack never used", s_task_names[i],
+                 (unsigned)uxTaskGetStackHighWaterMark(task));
+    }
+}
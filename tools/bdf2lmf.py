@@ -0,0 +1,231 @@
+#!/usr/bin/env python3
+"""Convert a BDF bitmap font to the luaMatrix .lmf format.
+
+The format is described in include/font.h. Upload the result to the
+device's /assets and pass its file name to draw_string():
+
+    python3 tools/bdf2lmf.py -r 32-126,160-255 helvR10.bdf assets/helv10.lmf
+    draw_string("Hello", 0, 0, 255, 255, 255, "helv10.lmf")
+
+With -d N the BDF is drawn at N times the target size and box-filtered
+down to a 4-bit coverage (anti-aliased) font, e.g. a 40 px BDF with -d 4
+gives a smooth 10 px font.
+"""
+
+import argparse
+import struct
+import sys
+
+MAX_HEIGHT = 32
+MAX_WIDTH = 32
+
+
+class Glyph:
+    def __init__(self, codepoint, advance, width, top, rows):
+        self.codepoint = codepoint
+        self.advance = advance
+        self.width = width
+        self.top = top
+        # 1-bit fonts: one int per row, bit 0 = leftmost pixel
+        # coverage fonts: one list of 0-15 values per row
+        self.rows = rows
+
+
+def parse_ranges(spec):
+    ranges = []
+    for part in spec.split(","):
+        lo, _, hi = part.partition("-")
+        lo = int(lo, 0)
+        hi = int(hi, 0) if hi else lo
+        ranges.append((lo, hi))
+    return ranges
+
+
+def wanted(codepoint, ranges):
+    return ranges is None or any(lo <= codepoint <= hi for lo, hi in ranges)
+
+
+def downsample(top, rows, width, factor, height):
+    """Box-filter a 1-bit glyph by factor into 4-bit coverage rows.
+
+    top is in source pixels; the result is aligned to the factor grid so
+    all glyphs share the same baseline.
+    """
+    dst_top = top // factor
+    skip = top - dst_top * factor
+    dst_rows = (skip + len(rows) + factor - 1) // factor
+    dst_width = min((width + factor - 1) // factor, MAX_WIDTH)
+    counts = [[0] * dst_width for _ in range(dst_rows)]
+    for y, row in enumerate(rows):
+        for x in range(width):
+            if row & (1 << x) and x // factor < dst_width:
+                counts[(y + skip) // factor][x // factor] += 1
+    area = factor * factor
+    out = [[(c * 15 + area // 2) // area for c in line] for line in counts]
+    out = out[:max(height - dst_top, 0)]
+    return dst_top, dst_width, out
+
+
+def read_bdf(path, ranges, spacing, factor):
+    ascent = descent = None
+    bbox = None
+    glyphs = []
+
+    with open(path, encoding="latin-1") as f:
+        lines = iter(f.read().splitlines())
+
+    for line in lines:
+        words = line.split()
+        if not words:
+            continue
+        key = words[0]
+        if key == "FONTBOUNDINGBOX":
+            bbox = [int(v) for v in words[1:5]]
+        elif key == "FONT_ASCENT":
+            ascent = int(words[1])
+        elif key == "FONT_DESCENT":
+            descent = int(words[1])
+        elif key == "STARTCHAR":
+            codepoint = None
+            advance = 0
+            bbx = None
+            for line in lines:
+                words = line.split()
+                if not words:
+                    continue
+                if words[0] == "ENCODING":
+                    codepoint = int(words[-1])
+                elif words[0] == "DWIDTH":
+                    advance = int(words[1])
+                elif words[0] == "BBX":
+                    bbx = [int(v) for v in words[1:5]]
+                elif words[0] == "BITMAP":
+                    break
+            bitmap = []
+            for line in lines:
+                if line.strip() == "ENDCHAR":
+                    break
+                bitmap.append(line.strip())
+            if codepoint is not None and codepoint >= 0 and wanted(codepoint, ranges):
+                glyphs.append((codepoint, advance, bbx, bitmap))
+
+    if bbox is None:
+        sys.exit("%s: no FONTBOUNDINGBOX" % path)
+    if ascent is None or descent is None:
+        ascent = bbox[1] + bbox[3]
+        descent = -bbox[3]
+    src_height = ascent + descent
+    height = (src_height + factor - 1) // factor
+    if height > MAX_HEIGHT:
+        sys.exit("%s: font is %d px high, at most %d supported" % (path, height, MAX_HEIGHT))
+    max_width = MAX_WIDTH * factor
+
+    result = []
+    for codepoint, advance, (w, h, xoff, yoff), bitmap in glyphs:
+        # Pixel columns start at the origin; anything left of it is cut off
+        width = min(max(xoff + w, 0), max_width)
+        top = ascent - (yoff + h)
+        rows = []
+        for hexrow in bitmap[:h]:
+            bits = int(hexrow, 16) if hexrow else 0
+            nbits = len(hexrow) * 4
+            row = 0
+            for col in range(w):
+                if bits & (1 << (nbits - 1 - col)):
+                    x = col + xoff
+                    if 0 <= x < max_width:
+                        row |= 1 << x
+            rows.append(row)
+
+        # Clip to the line box and drop blank rows at top and bottom
+        while top < 0 and rows:
+            rows.pop(0)
+            top += 1
+        rows = rows[:max(src_height - top, 0)]
+        while rows and rows[0] == 0:
+            rows.pop(0)
+            top += 1
+        while rows and rows[-1] == 0:
+            rows.pop()
+        if not rows:
+            top = width = 0
+        elif factor > 1:
+            top, width, rows = downsample(top, rows, width, factor, height)
+
+        advance = (advance + factor // 2) // factor
+        result.append(Glyph(codepoint, max(advance + spacing, 0), width, top, rows))
+
+    result.sort(key=lambda g: g.codepoint)
+    return height, result
+
+
+def write_lmf(path, height, glyphs, fallback_cp, coverage):
+    # Consecutive codepoints share a range entry
+    ranges = []
+    for index, glyph in enumerate(glyphs):
+        if ranges and ranges[-1][0] + ranges[-1][1] == glyph.codepoint and ranges[-1][1] < 0xFFFF:
+            ranges[-1][1] += 1
+        else:
+            ranges.append([glyph.codepoint, 1, index])
+
+    fallback = 0xFFFFFFFF
+    for index, glyph in enumerate(glyphs):
+        if glyph.codepoint == fallback_cp:
+            fallback = index
+
+    header_size = 16
+    table_size = len(ranges) * 12 + len(glyphs) * 8
+    offset = header_size + table_size
+
+    out = bytearray()
+    out += b"LMF1"
+    flags = 0x01 if coverage else 0
+    out += struct.pack("<BBHII", height, flags, len(ranges), len(glyphs), fallback)
+    for first, count, first_glyph in ranges:
+        out += struct.pack("<IHHI", first, count, 0, first_glyph)
+
+    bitmaps = bytearray()
+    for glyph in glyphs:
+        out += struct.pack("<IBBBB", offset + len(bitmaps), glyph.width,
+                           min(glyph.advance, 255), glyph.top, len(glyph.rows))
+        for row in glyph.rows:
+            if coverage:
+                # Two pixels per byte, low nibble first
+                padded = row + [0] * (len(row) % 2)
+                bitmaps += bytes(padded[i] | (padded[i + 1] << 4)
+                                 for i in range(0, len(padded), 2))
+            else:
+                bitmaps += row.to_bytes((glyph.width + 7) // 8, "little")
+    out += bitmaps
+
+    with open(path, "wb") as f:
+        f.write(out)
+    return len(out), len(ranges)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("bdf", help="input BDF font")
+    parser.add_argument("lmf", help="output .lmf file")
+    parser.add_argument("-r", "--ranges", type=parse_ranges, default=None,
+                        help="codepoints to keep, e.g. 32-126,0x400-0x4ff (default: all)")
+    parser.add_argument("-s", "--spacing", type=int, default=0,
+                        help="extra pixels added to every advance width")
+    parser.add_argument("-d", "--downsample", type=int, default=1, metavar="N",
+                        help="scale the BDF down by N into a 4-bit coverage font")
+    parser.add_argument("-f", "--fallback", type=lambda v: int(v, 0), default=ord("?"),
+                        help="codepoint drawn for unmapped characters (default: '?')")
+    args = parser.parse_args()
+
+    if args.downsample < 1:
+        sys.exit("--downsample must be at least 1")
+    height, glyphs = read_bdf(args.bdf, args.ranges, args.spacing, args.downsample)
+    if not glyphs:
+        sys.exit("%s: no glyphs in the requested ranges" % args.bdf)
+    size, nranges = write_lmf(args.lmf, height, glyphs, args.fallback, args.downsample > 1)
+    print("%s: %d px high, %d glyphs in %d ranges, %d bytes" %
+          (args.lmf, height, len(glyphs), nranges, size))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,118 @@
+#!/usr/bin/env python3
+"""Compile a web UI template into a C header for mgmt_template.c.
+
+Run by main/CMakeLists.txt for every page with placeholders:
+
+    python3 tools/compile_template.py main/templates/edit.html edit_html_tpl.h
+
+Placeholders are %NAME% or %NAME|filter% with NAME in upper case. The
+filter picks how the value is escaped when the page is rendered:
+
+    html  (default) for element text and attribute values
+    js    inside a quoted JavaScript string in a <script> block
+    raw   the value is trusted markup and sent as-is
+
+The header holds the static text with the placeholders cut out, and a
+segment table: each entry is a run of static text followed by the value
+to insert after it. For edit.html it defines edit_html_tpl and the enum
+EDIT_HTML_FILENAME, EDIT_HTML_ERRORTEXT, ... used to index the values
+passed to template_send().
+"""
+
+import argparse
+import os
+import re
+
+PLACEHOLDER = re.compile(rb"%([A-Z][A-Z0-9_]*)(?:\|([a-z]+))?%")
+FILTERS = {"html": "TEMPLATE_ESC_HTML", "js": "TEMPLATE_ESC_JS", "raw": "TEMPLATE_ESC_RAW"}
+MAX_TEXT = 0xFFFF
+
+
+def c_string(data):
+    out = []
+    for line in data.splitlines(keepends=True):
+        s = ""
+        for b in line:
+            c = chr(b)
+            if c == "\\" or c == '"':
+                s += "\\" + c
+            elif c == "\n":
+                s += "\\n"
+            elif 0x20 <= b < 0x7F and c != "?":
+                s += c
+            else:
+                # Octal keeps a following hex digit out of the escape
+                s += "\\%03o" % b
+        out.append('    "%s"' % s)
+    return "\n".join(out) if out else '    ""'
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("input")
+    ap.add_argument("output")
+    args = ap.parse_args()
+
+    with open(args.input, "rb") as f:
+        src = f.read()
+
+    base = re.sub(r"\W", "_", os.path.basename(args.input)).lower()
+    prefix = base.upper()
+
+    names = []
+    segments = []   # (offset, len, name or None, filter)
+    text = b""
+    pos = 0
+    for m in PLACEHOLDER.finditer(src):
+        name, flt = m.group(1).decode(), (m.group(2) or b"html").decode()
+        if flt not in FILTERS:
+            ap.error("%s: unknown filter '%s' for %s" % (args.input, flt, name))
+        if name not in names:
+            names.append(name)
+        chunk = src[pos:m.start()]
+        segments.append((len(text), len(chunk), name, flt))
+        text += chunk
+        pos = m.end()
+    chunk = src[pos:]
+    segments.append((len(text), len(chunk), None, "raw"))
+    text += chunk
+
+    if len(text) > MAX_TEXT:
+        ap.error("%s: %d bytes of text, at most %d supported" % (args.input, len(text), MAX_TEXT))
+
+    lines = [
+        "// Generated by tools/compile_template.py from %s - do not edit" % os.path.basename(args.input),
+        "#pragma once",
+        '#include "mgmt_template.h"',
+        "",
+        "enum {",
+    ]
+    lines += ["    %s_%s," % (prefix, n) for n in names]
+    lines += [
+        "    %s_NUM_VALUES" % prefix,
+        "};",
+        "",
+        "static const char %s_text[] =" % base,
+        c_string(text) + ";",
+        "",
+        "static const template_segment_t %s_segments[] = {" % base,
+    ]
+    for off, length, name, flt in segments:
+        value = "%s_%s" % (prefix, name) if name else "TEMPLATE_NO_VALUE"
+        lines.append("    { %d, %d, %s, %s }," % (off, length, value, FILTERS[flt]))
+    lines += [
+        "};",
+        "",
+        "static const template_t %s_tpl = {" % base,
+        "    %s_text, %s_segments," % (base, base),
+        "    sizeof(%s_segments) / sizeof(%s_segments[0]), %s_NUM_VALUES" % (base, base, prefix),
+        "};",
+        "",
+    ]
+
+    with open(args.output, "w") as f:
+        f.write("\n".join(lines))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,31 @@
+#!/usr/bin/env python3
+"""Gzip a web UI template for embedding in the firmware.
+
+Run by main/CMakeLists.txt for the static management pages; the httpd
+sends the result as-is with Content-Encoding: gzip:
+
+    python3 tools/gzip_asset.py main/templates/mgmt_index.html mgmt_index.html.gz
+
+The gzip header carries no file name or timestamp, so the output (and the
+ETag the firmware derives from it) only changes when the input does.
+"""
+
+import argparse
+import gzip
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("input")
+    ap.add_argument("output")
+    args = ap.parse_args()
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+    packed = gzip.compress(data, compresslevel=9, mtime=0)
+    with open(args.output, "wb") as f:
+        f.write(packed)
+
+
+if __name__ == "__main__":
+    main()